@@ -8,71 +8,169 @@
 #include "BitString.h"
 #include "OID.h"
 #include "strings.h"
+#include "span.h"
+#include "string_view.h"
+#include "segments.h"
+#include "traits.h"
 
 #include <vector>
 #include <list>
 #include <deque>
 #include <map>
 #include <set>
+#include <limits>
+#include <cstring>
+
+/* The deepest nesting BERDecoder will accept.  The nesting stack lives
+   inside the decoder, so setting one up (or reset()ting it) never touches
+   the heap.  Define this before including any asn1 headers to change it;
+   it must be the same in every translation unit. */
+#ifndef ASN1_BER_MAX_DEPTH
+#define ASN1_BER_MAX_DEPTH 32
+#endif
 
 BEGIN_ASN1_NS
 
 class BERDecoder
 {
+public:
+  /* By default, malformed input causes std::runtime_error to be thrown.
+     If you are decoding untrusted input at high rates (where most of the
+     traffic may be garbage), you can instead ask for NO_THROW, in which
+     case the first error is recorded and decoding stops, much like the
+     failbit on a std::istream, e.g.
+
+       asn1::BERDecoder d(data, len, asn1::BERDecoder::NO_THROW);
+
+       d >> asn1::sequence >> name >> flag >> asn1::end;
+
+       if (!d)
+         log (d.errorMessage(), d.errorOffset());
+
+     Once an error has occurred, every subsequent read fails, atEnd()
+     returns true and the values of any further extracted objects are
+     unspecified. */
+  typedef enum {
+    THROW = 0,
+    NO_THROW = 1
+  } ErrorMode;
+
+  typedef enum {
+    OK = 0,
+    OUT_OF_BOUNDS,        // Ran off the end of the data or enclosing value
+    BAD_TBF,              // Base-128 number too long
+    BAD_LENGTH,           // Malformed length octets
+    UNEXPECTED_TAG,
+    BAD_END_OF_CONTENTS,
+    EXPECTED_END,         // Octets left over at the end of a value
+    UNBALANCED_END,       // More ends than sequences/sets
+    NESTING_TOO_DEEP,     // More than ASN1_BER_MAX_DEPTH levels
+    OUT_OF_RANGE,         // Value won't fit in the target type
+    BAD_VALUE,            // Contents octets not valid for the type
+    UNSUPPORTED           // Valid, but not something we can decode
+  } Error;
+
 private:
+  const octet *_base;
   const octet *_ptr;
   const octet *_end;
+  const octet *_limit;
 
 private:
+  /* For an indefinite length value, end is the end of the nearest
+     enclosing definite length value, so that popState() can restore it. */
   struct State {
     const octet *end;
-
-    State(const octet *e) : end(e) {}
-    State(State &&other) : end(other.end) {}
-    State(const State &other) : end(other.end) {}
-
-    State &operator=(const State &other) {
-      end = other.end;
-      return *this;
-    }
-    State &operator=(State &&other) {
-      end = other.end;
-      return *this;
-    }
+    bool         indefinite;
   };
 
+  static const unsigned max_depth = ASN1_BER_MAX_DEPTH;
+
   State              *_state;
-  std::vector<State>  _stack;
+  State               _stack[max_depth + 1];
+  unsigned            _depth;
 
   bool                _override_next_tag;
   Tag                 _next_tag;
-  bool                _next_tag_constructed;
+  PrimitiveOrConstructed _next_tag_constructed;
+
+  ErrorMode           _mode;
+  Error               _error;
+  size_t              _error_offset;
+  const char         *_error_message;
+
+  size_t remaining() const {
+    return _ptr < _end ? _end - _ptr : 0;
+  }
 
 public:
-  BERDecoder (const octet *data, size_t len)
-    : _ptr(data), _end(data + len), _stack(1, State(data + len)) { 
-    _state = &_stack.back();
+  BERDecoder (const octet *data, size_t len, ErrorMode mode = THROW)
+    : _mode(mode) {
+    reset (data, len);
+  }
+
+  /* Start decoding a new message, so that one decoder can be reused for
+     many PDUs without any further setup cost. */
+  void reset(const octet *data, size_t len) {
+    _base = _ptr = data;
+    _end = _limit = data + len;
+    _depth = 0;
+    _stack[0].end = _end;
+    _stack[0].indefinite = false;
+    _state = &_stack[0];
+    _override_next_tag = false;
+    _error = OK;
+    _error_offset = 0;
+    _error_message = nullptr;
+  }
+
+  /* Report malformed input.  In NO_THROW mode we remember the first
+     error, then move to the very end of the input so that all subsequent
+     reads fail without any further tests. */
+  void fail(Error e, const char *message) {
+    if (_mode == THROW)
+      throw std::runtime_error(message);
+
+    if (!_error) {
+      _error = e;
+      _error_offset = _ptr - _base;
+      _error_message = message;
+    }
+
+    _ptr = _limit;
   }
 
+  ErrorMode errorMode() const { return _mode; }
+  bool failed() const { return _error != OK; }
+  Error error() const { return _error; }
+  size_t errorOffset() const { return _error_offset; }
+  const char *errorMessage() const { return _error_message; }
+
+  explicit operator bool() const { return !failed(); }
+
   bool inIndefinite() { 
-    return !_state->end;
+    return _state->indefinite;
   }
 
   bool atEnd() {
     // If we're in an indefinite mode, we also report atEnd() an an EOC
-    return _ptr >= _end || !_state->end && !*_ptr;
+    return _ptr >= _end || (_state->indefinite && !*_ptr);
   }
 
   octet getOctet() {
-    if (_ptr >= _end)
-      throw std::runtime_error("out of bounds");
+    if (_ptr >= _end) {
+      fail (OUT_OF_BOUNDS, "out of bounds");
+      return 0;
+    }
 
     return *_ptr++;
   }
 
   uint16 get16() {
-    if (_ptr + 2 > _end)
-      throw std::runtime_error("out of bounds");
+    if (_end - _ptr < 2) {
+      fail (OUT_OF_BOUNDS, "out of bounds");
+      return 0;
+    }
 
     uint16 ret = *(uint16 *)_ptr;
     _ptr += 2;
@@ -80,17 +178,21 @@ public:
   }
 
   uint32 get32() {
-    if (_ptr + 4 > _end)
-      throw std::runtime_error("out of bounds");
+    if (_end - _ptr < 4) {
+      fail (OUT_OF_BOUNDS, "out of bounds");
+      return 0;
+    }
 
     uint32 ret = *(uint32 *)_ptr;
     _ptr += 4;
     return machine::from_be(ret);
   }
 
-  uint32 get64() {
-    if (_ptr + 8 > _end)
-      throw std::runtime_error("out of bounds");
+  uint64 get64() {
+    if (_end - _ptr < 8) {
+      fail (OUT_OF_BOUNDS, "out of bounds");
+      return 0;
+    }
 
     uint64 ret = *(uint64 *)_ptr;
     _ptr += 8;
@@ -100,10 +202,13 @@ public:
   uint32 getTBF() {
     uint32 result = 0;
     unsigned count = 0;
+    octet o;
 
     do {
-      if (++count > 4)
-        throw std::runtime_error("bad TBF value");
+      if (++count > 4) {
+        fail (BAD_TBF, "bad TBF value");
+        return 0;
+      }
       o = getOctet();
       result = (result << 7) | (o & 0x7f);
     } while (o & 0x80);
@@ -111,15 +216,96 @@ public:
     return result;
   }
 
+  /* Reads within a verified region.  The contents of a definite length
+     value have already been checked against the end of the enclosing
+     value, by decodeLength() or pushState(), so a decoder that knows it
+     is within them can read without checking each octet.  These must
+     only be used after such a check. */
+  octet getOctetUnchecked() {
+    return *_ptr++;
+  }
+
+  /* getTBF() where the caller has checked that the region being read
+     ends with an octet that has its top bit clear, so that every TBF
+     value starting within it also ends within it. */
+  uint32 getTBFUnchecked() {
+    uint32 result = 0;
+    unsigned count = 0;
+    octet o;
+
+    do {
+      if (++count > 4) {
+        fail (BAD_TBF, "bad TBF value");
+        return 0;
+      }
+      o = *_ptr++;
+      result = (result << 7) | (o & 0x7f);
+    } while (o & 0x80);
+
+    return result;
+  }
+
+  /* Append the base-128 numbers in the next len octets (the contents of
+     an OBJECT IDENTIFIER or RELATIVE-OID) to v.  We check once that the
+     last octet ends a number, then read them all unchecked. */
+  template <class Vector>
+  void decodeTBFs(size_t len, Vector &v) {
+    if (!len || len > remaining()) {
+      fail (len ? OUT_OF_BOUNDS : BAD_VALUE,
+            len ? "out of bounds" : "missing subidentifier");
+      return;
+    }
+    if (_ptr[len - 1] & 0x80) {
+      fail (BAD_TBF, "truncated TBF value");
+      return;
+    }
+
+    const octet *end = _ptr + len;
+
+    while (_ptr < end)
+      v.push_back (getTBFUnchecked());
+  }
+
+  /* Assemble an INTEGER whose len contents octets are next, and have
+     already been checked to lie within the input (as decodeLength() and
+     expectHeader() do), with one load rather than a checked read per
+     octet.  Returns false, consuming nothing, if the value won't fit in
+     Int. */
+  template <class Int>
+  bool getInteger(size_t len, Int &v) {
+    if (len > remaining()
+        || !decodeIntegerContents<Int> (_ptr, len, remaining(), v))
+      return false;
+    _ptr += len;
+    return true;
+  }
+
+  // Returns NULL if there aren't n octets left (in NO_THROW mode)
   const octet *getOctets(size_t n) {
-    if (_ptr + n > _end)
-      throw std::runtime_error("out of bounds");
+    if (n > remaining()) {
+      fail (OUT_OF_BOUNDS, "out of bounds");
+      return NULL;
+    }
 
     const octet *ret = _ptr;
     _ptr += n;
     return ret;
   }
 
+  // True if the next n octets are exactly those at p
+  bool peekOctets(const octet *p, size_t n) const {
+    return remaining() >= n && !std::memcmp (_ptr, p, n);
+  }
+
+  /* As peekOctets(), but also consumes them if they match; this is how
+     we compare pre-encoded identifier octets (see schema.h). */
+  bool matchOctets(const octet *p, size_t n) {
+    if (!peekOctets (p, n))
+      return false;
+    _ptr += n;
+    return true;
+  }
+
   Tag decodeTag(PrimitiveOrConstructed &c) {
     octet t = getOctet();
     TagClass tc = (TagClass)(t >> 6);
@@ -136,32 +322,52 @@ public:
   Tag peekTag(PrimitiveOrConstructed &c) {
     const octet *savedPtr = _ptr;
     Tag t = decodeTag(c);
-    _ptr = savedPtr;
+    if (!failed())
+      _ptr = savedPtr;
     return t;
   }
 
-  uint32 decodeLength() {
-    octet o = getOctet();
+  /* Long-form lengths may use up to sizeof(size_t) octets, so on 64-bit
+     platforms we can decode values larger than 4GB. */
+  size_t decodeLongLength(unsigned count) {
+    if (count > sizeof(size_t) || count < 1) {
+      fail (BAD_LENGTH, "bad length value");
+      return 0;
+    }
 
-    if (o <= 0x7f)
-      return o;
+    const octet *p = getOctets(count);
+    size_t len = 0;
 
-    unsigned count = o & 0x7f;
+    if (!p)
+      return 0;
 
-    if (count > 4 || count < 1)
-      throw std::runtime_error("bad length value");
+    while (count--)
+      len = (len << 8) | *p++;
 
-    if (count == 4)
-      return get32();
-    else if (count == 3)
-      return (getOctet() << 24) | get16();
-    else if (count == 2)
-      return get16();
-    else
-      return getOctet();
+    return len;
+  }
+
+  /* A definite length must fit in what's left of the enclosing value, so
+     we check that here, once, rather than every time the contents are
+     read.  After an error, the length is always zero. */
+  size_t checkLength(size_t len) {
+    if (len > remaining()) {
+      fail (OUT_OF_BOUNDS, "out of bounds");
+      return 0;
+    }
+    return len;
   }
 
-  uint32 decodeLengthOrIndefinite(bool &indefinite) {
+  size_t decodeLength() {
+    octet o = getOctet();
+
+    if (o <= 0x7f)
+      return checkLength(o);
+
+    return checkLength(decodeLongLength(o & 0x7f));
+  }
+
+  size_t decodeLengthOrIndefinite(bool &indefinite) {
     octet o = getOctet();
 
     if (o == 0x80) {
@@ -169,23 +375,11 @@ public:
       return 0;
     }
 
-    if (o < 0x7f)
-      return o;
-
-    unsigned count = o & 0x7f;
-
-    if (count > 4 || count < 1)
-      throw std::runtime_error("bad length value");
+    if (o <= 0x7f)
+      return checkLength(o);
 
-    if (count == 4)
-      return get32();
-    else if (count == 3)
-      return (getOctet() << 24) | get16();
-    else if (count == 2)
-      return get16();
-    else
-      return getOctet();
-  }      
+    return checkLength(decodeLongLength(o & 0x7f));
+  }
 
   void overrideNextTag(const Tag t, PrimitiveOrConstructed c)
   {
@@ -197,6 +391,7 @@ public:
   }
 
   void expectTag(Tag t, PrimitiveOrConstructed pc = PRIMITIVE) {
+    const octet *start = _ptr;
     PrimitiveOrConstructed c;
     Tag rt = decodeTag (c);
 
@@ -206,33 +401,409 @@ public:
       pc = _next_tag_constructed;
     }
 
-    if (rt != t || c != pc)
-      throw std::runtime_error("unexpected tag");
+    if (rt != t || c != pc) {
+      // Report the offset of the tag, not the octet after it
+      if (!failed())
+        _ptr = start;
+      fail (UNEXPECTED_TAG, "unexpected tag");
+    }
+  }
+
+  /* Decode an identifier and its length together.  Almost every element
+     has a one-octet identifier and a short-form length; for those we do
+     one bounds check, one 16-bit load and one (well predicted) branch,
+     and only fall back to decodeTag() and decodeLengthOrIndefinite() for
+     anything else.  A definite length is checked against what's left, as
+     decodeLength() does. */
+  Tag decodeHeader(PrimitiveOrConstructed &c, size_t &len, bool &indefinite) {
+    if (remaining() >= 2) {
+      uint16 h = load16 (_ptr);
+      size_t l = h & 0xff;
+
+      if ((h & 0x1f00) != 0x1f00 && l <= 0x7f && l <= remaining() - 2) {
+        octet t = h >> 8;
+        _ptr += 2;
+        c = (t & 0x20) ? CONSTRUCTED : PRIMITIVE;
+        len = l;
+        indefinite = false;
+        return Tag((TagClass)(t >> 6), t & 0x1f);
+      }
+    }
+
+    Tag t = decodeTag (c);
+    indefinite = false;
+    len = decodeLengthOrIndefinite (indefinite);
+    return t;
+  }
+
+  /* expectTag() followed by decodeLength(), fused as above; returns the
+     length of the contents. */
+  size_t expectHeader(Tag t, PrimitiveOrConstructed pc = PRIMITIVE) {
+    if (_override_next_tag) {
+      _override_next_tag = false;
+      t = _next_tag;
+      pc = _next_tag_constructed;
+    }
+
+    if (t.number < 31 && remaining() >= 2) {
+      uint16 id = (t.tagClass << 6) | (pc ? 0x20 : 0) | t.number;
+      uint16 h = load16 (_ptr);
+      size_t len = h & 0xff;
+
+      if ((h & 0xff80) == id << 8 && len <= remaining() - 2) {
+        _ptr += 2;
+        return len;
+      }
+    }
+
+    expectTag (t, pc);
+    return decodeLength();
+  }
+
+  // As above, for constructed values, which may be indefinite length
+  size_t expectHeader(Tag t, PrimitiveOrConstructed pc, bool &indefinite) {
+    if (_override_next_tag) {
+      _override_next_tag = false;
+      t = _next_tag;
+      pc = _next_tag_constructed;
+    }
+
+    indefinite = false;
+
+    if (t.number < 31 && remaining() >= 2) {
+      uint16 id = (t.tagClass << 6) | (pc ? 0x20 : 0) | t.number;
+      uint16 h = load16 (_ptr);
+      size_t len = h & 0xff;
+
+      if ((h & 0xff80) == id << 8 && len <= remaining() - 2) {
+        _ptr += 2;
+        return len;
+      }
+    }
+
+    expectTag (t, pc);
+    return decodeLengthOrIndefinite (indefinite);
   }
 
   void expectEndOfContents() {
     octet t = getOctet();
-    if (t != 0)
-      throw std::runtime_error("expected End of Contents tag");
+    if (t != 0) {
+      fail (BAD_END_OF_CONTENTS, "expected End of Contents tag");
+      return;
+    }
     octet l = getOctet();
     if (l != 0)
-      throw std::runtime_error("bad length on End of Contents tag");
+      fail (BAD_END_OF_CONTENTS, "bad length on End of Contents tag");
   }
 
-  void pushState(bool indefinite=true, uint32 len=0) {
-    if (!indefinite && _ptr + len > _end)
-      throw std::runtime_error("out of bounds");
+  void pushState(bool indefinite=true, size_t len=0) {
+    const octet *end = _end;
+
+    if (!indefinite) {
+      // We still push a state on error, so that the matching end balances
+      if (len > remaining())
+        fail (OUT_OF_BOUNDS, "out of bounds");
+      end = failed() ? _end : _ptr + len;
+    }
 
-    _stack.push_back(BEREncoder::State(indefinite ? NULL : _ptr + len));
-    _state = &_stack.back();
-    if (_state->end)
-      _end = _state->end;
+    /* Past the limit (which can only happen in NO_THROW mode) we just
+       count levels, so that the matching ends still balance; since all
+       reads fail from here on, the missing states don't matter. */
+    if (_depth >= max_depth)
+      fail (NESTING_TOO_DEEP, "nesting too deep");
+
+    if (++_depth > max_depth)
+      return;
+
+    _state = &_stack[_depth];
+    _state->end = _end = end;
+    _state->indefinite = indefinite;
   }
   void popState() {
-    _stack.pop_back();
-    _state = &_stack.back();
-    if (_state->end)
-      _end = _state->end;
+    if (!_depth) {
+      fail (UNBALANCED_END, "end without matching sequence or set");
+      return;
+    }
+
+    if (--_depth >= max_depth)
+      return;
+
+    _state = &_stack[_depth];
+    _end = _state->end;
+  }
+
+  /* Skip the next element without decoding it.  Definite length values
+     are skipped in one step; for indefinite length values we just count
+     nesting levels until we find the matching End of Contents. */
+  void skip() {
+    unsigned depth = 0;
+
+    _override_next_tag = false;
+
+    do {
+      if (depth && _ptr < _end && !*_ptr) {
+        expectEndOfContents();
+        --depth;
+        continue;
+      }
+
+      PrimitiveOrConstructed c;
+      bool indefinite;
+      size_t len;
+
+      decodeHeader (c, len, indefinite);
+
+      if (indefinite) {
+        if (c == PRIMITIVE)
+          fail (BAD_LENGTH, "indefinite length on primitive value");
+        ++depth;
+      } else {
+        getOctets (len);
+      }
+    } while (depth && !failed());
+  }
+
+  /* Find an element without decoding anything else, e.g.
+
+       asn1::octet_span s = d.find ({ asn1::tSequence, asn1::ctx(3) });
+
+     returns the contents of the first [3] inside the first SEQUENCE at
+     the current position.  Each tag is looked for amongst the siblings
+     at that level, skipping anything that doesn't match, and all but the
+     last must be constructed.  The decoder itself doesn't move.
+
+     If there is no such element, the result has a NULL data() pointer.
+     Malformed input throws, unless we're in NO_THROW mode, in which case
+     it just isn't found. */
+  octet_span find(std::initializer_list<Tag> path) {
+    BERDecoder sub(_ptr, remaining(), _mode);
+
+    for (const Tag *i = path.begin(); i != path.end(); ++i) {
+      PrimitiveOrConstructed c;
+
+      for (;;) {
+        if (sub.atEnd())
+          return octet_span();
+        if (sub.peekTag (c) == *i)
+          break;
+        sub.skip();
+      }
+
+      bool indefinite;
+      size_t len;
+
+      sub.decodeHeader (c, len, indefinite);
+
+      if (sub.failed())
+        return octet_span();
+
+      if (i + 1 != path.end()) {
+        if (c != CONSTRUCTED)
+          return octet_span();
+        sub.pushState (indefinite, len);
+        continue;
+      }
+
+      const octet *value = sub._ptr;
+
+      if (!indefinite)
+        return octet_span(value, len);
+
+      // Find the End of Contents
+      sub.pushState();
+      while (!sub.atEnd())
+        sub.skip();
+      if (sub._ptr >= sub._end)
+        sub.fail (BAD_END_OF_CONTENTS, "missing End of Contents");
+      if (sub.failed())
+        return octet_span();
+      return octet_span(value, sub._ptr);
+    }
+
+    return octet_span();
+  }
+
+  /* Strings may use either the primitive or the constructed form, so
+     check just the tag, returning the form actually used. */
+  PrimitiveOrConstructed expectStringTag(Tag t) {
+    const octet *start = _ptr;
+    PrimitiveOrConstructed c;
+    Tag rt = decodeTag (c);
+
+    if (_override_next_tag) {
+      _override_next_tag = false;
+      t = _next_tag;
+    }
+
+    if (rt != t) {
+      if (!failed())
+        _ptr = start;
+      fail (UNEXPECTED_TAG, "unexpected tag");
+    }
+
+    return c;
+  }
+
+  /* Decode an OCTET STRING, BIT STRING or character string with tag t,
+     in either form, appending its primitive segments to s (see
+     segments.h).  The segments of a constructed value are OCTET STRINGs
+     (or BIT STRINGs if bits is set), and may themselves be constructed. */
+  void decodeSegments(Tag t, octet_segments &s, bool bits = false) {
+    if (expectStringTag (t) == PRIMITIVE) {
+      decodeSegment (s, bits);
+      return;
+    }
+
+    bool indefinite = false;
+    size_t len = decodeLengthOrIndefinite (indefinite);
+
+    pushState (indefinite, len);
+    while (!atEnd())
+      decodeSegments (bits ? tBitString : tOctetString, s, bits);
+    if (inIndefinite())
+      expectEndOfContents();
+    popState();
+  }
+
+  // The contents of a single primitive segment
+  void decodeSegment(octet_segments &s, bool bits) {
+    size_t len = decodeLength();
+
+    if (bits) {
+      if (!len) {
+        fail (BAD_VALUE, "missing initial octet in bit string");
+        return;
+      }
+      if (s.unused_bits()) {
+        fail (BAD_VALUE, "unused bits in bit string segment before the last");
+        return;
+      }
+
+      octet unused = getOctet();
+
+      if (unused > 7 || (len == 1 && unused)) {
+        fail (BAD_VALUE, "bad unused bit count in bit string");
+        return;
+      }
+
+      s.set_unused_bits (unused);
+      --len;
+    }
+
+    const octet *ptr = getOctets (len);
+
+    if (ptr)
+      s.push_back (octet_span (ptr, len));
+  }
+
+  // Load two big-endian octets, without any alignment requirement
+  static uint16 load16(const octet *p) {
+    uint16 h;
+    std::memcpy (&h, p, sizeof(h));
+    return machine::from_be(h);
+  }
+
+  /* Load len (1 to 8) big-endian octets into the top of a uint64.  When
+     there are at least eight octets available, which is nearly always,
+     we do one unaligned load of a constant size (so the compiler emits a
+     single instruction); otherwise we copy into a zeroed temporary so we
+     never read past the end of the input. */
+  static uint64 loadBigEndian(const octet *p, unsigned len, size_t avail) {
+    uint64 w = 0;
+    if (avail >= sizeof(w))
+      std::memcpy (&w, p, sizeof(w));
+    else
+      std::memcpy (&w, p, len);
+    return machine::from_be(w);
+  }
+
+  /* Assemble the len contents octets of an INTEGER at p into v, with one
+     load, a byteswap and a shift.  Returns false if the value won't fit
+     in Int, leaving the error reporting to the caller. */
+  template <class Int>
+  static bool decodeIntegerContents(const octet *p, size_t len,
+                                    size_t avail, Int &v) {
+    if (!len)
+      return false;
+
+    if (!std::numeric_limits<Int>::is_signed) {
+      if (p[0] & 0x80)
+        return false;
+      // Allow a leading zero octet on values with the top bit set
+      if (len == sizeof(Int) + 1 && !p[0]) {
+        ++p;
+        --len;
+        --avail;
+      }
+    }
+
+    if (!len || len > sizeof(Int))
+      return false;
+
+    uint64 w = loadBigEndian (p, len, avail);
+    unsigned shift = 64 - 8 * len;
+
+    if (std::numeric_limits<Int>::is_signed)
+      v = static_cast<Int>(static_cast<int64>(w) >> shift);
+    else
+      v = static_cast<Int>(w >> shift);
+
+    return true;
+  }
+
+  /* Bulk decoding for SEQUENCE OF INTEGER or ENUMERATED.  Working directly
+     on the input, decode as many consecutive elements with the identifier
+     octet t and a short form length as we can, appending convert(value)
+     to v.  We stop at the end of the enclosing value, or at anything
+     unusual (long form lengths, out of range values, errors), which the
+     caller then handles by decoding one element the ordinary way. */
+  template <class Int, class Vector, class Convert>
+  void decodeIntegerRun(octet t, Vector &v, Convert convert) {
+    const octet *p = _ptr;
+    const octet *e = _end;
+
+    if (_override_next_tag || e - p < 3)
+      return;
+
+    // Each element is at least three octets
+    if (!inIndefinite())
+      v.reserve (v.size() + (e - p) / 3);
+
+    while (e - p >= 3 && p[0] == t) {
+      unsigned len = p[1];
+      const octet *q = p + 2;
+      size_t avail = e - q;
+      Int value;
+
+      if (len > avail
+          || !decodeIntegerContents<Int> (q, len, avail, value))
+        break;
+
+      v.push_back (convert (value));
+      p = q + len;
+    }
+
+    _ptr = p;
+  }
+
+  // As above, for SEQUENCE OF BOOLEAN
+  template <class Vector>
+  void decodeBooleanRun(Vector &v) {
+    const octet *p = _ptr;
+    const octet *e = _end;
+
+    if (_override_next_tag || e - p < 3)
+      return;
+
+    if (!inIndefinite())
+      v.reserve (v.size() + (e - p) / 3);
+
+    while (e - p >= 3 && p[0] == 0x01 && p[1] == 0x01) {
+      v.push_back (p[2] != 0);
+      p += 3;
+    }
+
+    _ptr = p;
   }
 };
 
@@ -241,88 +812,47 @@ inline BERDecoder &operator>> (BERDecoder &d, BERDecoder &(*pf)(BERDecoder &)) {
 }
 
 inline BERDecoder &operator>> (BERDecoder &d, bool &b) {
-  d.expectTag (tBoolean);
-  if (d.decodeLength() != 1)
-    throw std::runtime_error("incorrect length for boolean");
-  b = d.getOctet() ? true : false;
+  if (d.expectHeader (tBoolean) != 1) {
+    d.fail (BERDecoder::BAD_VALUE, "incorrect length for boolean");
+    return d;
+  }
+  b = d.getOctetUnchecked() ? true : false;
 
   return d;
 }
 
 inline BERDecoder &operator>> (BERDecoder &d, int32 &i) {
-  d.expectTag (tInteger);
-  uint32 len = d.decodeLength();
+  size_t len = d.expectHeader (tInteger);
 
-  if (!len || len > 4)
-    throw std::runtime_error("integer outside range for int32");
-
-  octet o = d.getOctet();
-  i = 0;
-  if (o & 0x80) {
-    for (unsigned n = len; n < 4; ++n)
-      i = (i << 8) | 0xff;
-  }
-  i = (i << 8) | o;
-  for (unsigned n = 1; n < len; ++n)
-    i = (i << 8) | d.getOctet();
+  if (!d.getInteger (len, i))
+    d.fail (BERDecoder::OUT_OF_RANGE, "integer outside range for int32");
 
   return d;
 }
 
 inline BERDecoder &operator>> (BERDecoder &d, uint32 &u) {
-  d.expectTag (tInteger);
-  uint32 len = d.decodeLength();
-
-  if (!len || len > 5)
-    throw std::runtime_error("integer outside range for uint32");
-
-  octet o = d.getOctet();
-
-  if ((len == 5 && o) || (o & 0x80))
-    throw std::runtime_error("integer outside range for uint32");
+  size_t len = d.expectHeader (tInteger);
 
-  u = o;
-  for (unsigned n = 1; n < len; ++n)
-    u = (u << 8) | d.getOctet();
+  if (!d.getInteger (len, u))
+    d.fail (BERDecoder::OUT_OF_RANGE, "integer outside range for uint32");
 
   return d;
 }
 
 inline BERDecoder &operator>> (BERDecoder &d, int64 &i) {
-  d.expectTag (tInteger);
-  uint32 len = d.decodeLength();
+  size_t len = d.expectHeader (tInteger);
 
-  if (!len || len > 8)
-    throw std::runtime_error("integer outside range for int64");
-
-  octet o = d.getOctet();
-  i = 0;
-  if (o & 0x80) {
-    for (unsigned n = len; n < 8; ++n)
-      i = (i << 8) | 0xff;
-  }
-  i = (i << 8) | o;
-  for (unsigned n = 1; n < len; ++n)
-    i = (i << 8) | d.getOctet();
+  if (!d.getInteger (len, i))
+    d.fail (BERDecoder::OUT_OF_RANGE, "integer outside range for int64");
 
   return d;
 }
 
 inline BERDecoder &operator>> (BERDecoder &d, uint64 &u) {
-  d.expectTag (tInteger);
-  uint32 len = d.decodeLength();
-
-  if (!len || len > 9)
-    throw std::runtime_error("integer outside range for uint64");
-
-  octet o = d.getOctet();
+  size_t len = d.expectHeader (tInteger);
 
-  if ((len == 9 && o) || (o & 0x80))
-    throw std::runtime_error("integer outside range for uint64");
-
-  u = o;
-  for (unsigned n = 1; n < len; ++n)
-    u = (u << 8) | d.getOctet();
+  if (!d.getInteger (len, u))
+    d.fail (BERDecoder::OUT_OF_RANGE, "integer outside range for uint64");
 
   return d;
 }
@@ -334,8 +864,7 @@ inline BERDecoder &operator>> (BERDecoder &d, double &r) {
     double d;
   } un;
   
-  d.expectTag (tReal);
-  uint32 len = d.decodeLength();
+  size_t len = d.expectHeader (tReal);
   
   /* 8.5.2 If the real value is the value plus zero, there shall be no
      contents octets in the encoding */
@@ -371,31 +900,39 @@ inline BERDecoder &operator>> (BERDecoder &d, double &r) {
         r = un.d;
         break;
       default:
-        throw std::runtime_error("unknown special real value");
+        d.fail (BERDecoder::BAD_VALUE, "unknown special real value");
+        return d;
       }
       return d;
     }
 
-    throw std::runtime_error("invalid real encoding");
+    d.fail (BERDecoder::BAD_VALUE, "invalid real encoding");
+    return d;
   }
 
   // The first contents octet tells us more
   o = d.getOctet();
 
-  if ((o & 0xc0) == 0x00)
-    throw std::runtime_error("attempt to read base-10 real into IEEE double");
+  if ((o & 0xc0) == 0x00) {
+    d.fail (BERDecoder::UNSUPPORTED,
+            "attempt to read base-10 real into IEEE double");
+    return d;
+  }
 
-  if ((o & 0xc0) == 0x40)
-    throw std::runtime_error("length of special real value must be 1");
+  if ((o & 0xc0) == 0x40) {
+    d.fail (BERDecoder::BAD_VALUE, "length of special real value must be 1");
+    return d;
+  }
 
   unsigned base;
 
   switch (o & 0x30) {
-  case 0: base = 2; break;
-  case 1: base = 8; break;
-  case 2: base = 16; break;
+  case 0x00: base = 2; break;
+  case 0x10: base = 8; break;
+  case 0x20: base = 16; break;
   default:
-    throw std::runtime_error("unknown base for real number");
+    d.fail (BERDecoder::BAD_VALUE, "unknown base for real number");
+    return d;
   }
 
   unsigned factor = (o >> 2) & 0x03;
@@ -428,11 +965,17 @@ inline BERDecoder &operator>> (BERDecoder &d, double &r) {
     {
       unsigned elen = d.getOctet();
 
-      if (!elen)
-        throw std::runtime_error("zero-length exponent(!) in real number");
+      if (!elen) {
+        d.fail (BERDecoder::BAD_VALUE,
+                "zero-length exponent(!) in real number");
+        return d;
+      }
 
-      if (elen > 4)
-        throw std::runtime_error("exponent too large in real number");
+      if (elen > 4) {
+        d.fail (BERDecoder::OUT_OF_RANGE,
+                "exponent too large in real number");
+        return d;
+      }
 
       unsigned sign = 0x80;
 
@@ -451,8 +994,10 @@ inline BERDecoder &operator>> (BERDecoder &d, double &r) {
     break;
   }
 
-  if (!len)
-    throw std::runtime_error("no mantissa octets in real number");
+  if (!len) {
+    d.fail (BERDecoder::BAD_VALUE, "no mantissa octets in real number");
+    return d;
+  }
 
   // Convert the exponent to base 2
   if (base == 8)
@@ -474,19 +1019,19 @@ inline BERDecoder &operator>> (BERDecoder &d, double &r) {
     u = d.get16();
     break;
   case 3:
-    u = d.get16() << 8 | d.getOctet();
+    u = uint64(d.get16()) << 8 | d.getOctet();
     break;
   case 4:
-    u = d.get32() << 32;
+    u = d.get32();
     break;
   case 5:
-    u = d.get32() << 8 | d.getOctet();
+    u = uint64(d.get32()) << 8 | d.getOctet();
     break;
   case 6:
-    u = d.get32() << 16 | d.get16();
+    u = uint64(d.get32()) << 16 | d.get16();
     break;
   case 7:
-    u = d.get32() << 24 | d.get16() << 8 | d.getOctet();
+    u = uint64(d.get32()) << 24 | uint64(d.get16()) << 8 | d.getOctet();
     break;
   case 8:
   default:
@@ -497,7 +1042,13 @@ inline BERDecoder &operator>> (BERDecoder &d, double &r) {
     break;
   }
 
-  // Align the mantissa
+  if (!u) {
+    r = sign ? -0.0 : 0.0;
+    return d;
+  }
+
+  // Align the mantissa so that its leading 1 is bit 52; the value is then
+  // (u / 2^52) * 2^(exponent + 52)
   unsigned lz = machine::clz(u);
 
   if (lz > 11) {
@@ -514,6 +1065,8 @@ inline BERDecoder &operator>> (BERDecoder &d, double &r) {
     u >>= shift;
   }
 
+  exponent += 52;
+
   if (exponent < -1022) {
     // Need to turn this into a subnormal number
     unsigned shift = -1022 - exponent;
@@ -535,7 +1088,7 @@ inline BERDecoder &operator>> (BERDecoder &d, double &r) {
 
   // Strip the implied 1, if present
   u &= 0x000fffffffffffff;
-  u |= exponent << 52;
+  u |= uint64(exponent) << 52;
   if (sign)
     u |= 0x8000000000000000;
 
@@ -547,57 +1100,79 @@ inline BERDecoder &operator>> (BERDecoder &d, double &r) {
 
 template <class A>
 BERDecoder &operator>> (BERDecoder &d, std::vector<octet, A> &v) {
-  d.expectTag (tOctetString);
-  uint32 len = d.decodeLength();
-  octet *ptr = d.getOctets (len);
-  v.insert (v.end(), ptr, ptr + len);
+  octet_segments s;
+  d.decodeSegments (tOctetString, s);
+  s.coalesce (v);
+  return d;
+}
+
+/* Decode an OCTET STRING, in either form, as a list of segments pointing
+   into the buffer being decoded. */
+inline BERDecoder &operator>> (BERDecoder &d, octet_segments &s) {
+  s.clear();
+  d.decodeSegments (tOctetString, s);
+  return d;
+}
+
+/* Decode an OCTET STRING without copying it; the span points into the
+   buffer being decoded.  This only works for the primitive form. */
+inline BERDecoder &operator>> (BERDecoder &d, octet_span &s) {
+  if (d.expectStringTag (tOctetString) == CONSTRUCTED) {
+    d.fail (BERDecoder::UNSUPPORTED,
+            "cannot view a constructed string; use octet_segments");
+    return d;
+  }
+  size_t len = d.decodeLength();
+  const octet *ptr = d.getOctets (len);
+  s = octet_span (ptr, ptr ? len : 0);
   return d;
 }
 
 template <class A>
-BERDecoder &operator>> (BERDecoder &d, const BitString<A> &v) {
-  d.expectTag (tBitString);
-  uint32 len = d.decodeLength();
-  octet ignored = d.getOctet();
-  v.assign (d.getOctets(len), len * 8 - ignored);
+BERDecoder &operator>> (BERDecoder &d, BitString<A> &v) {
+  octet_segments s;
+  std::vector<octet> tmp;
+
+  d.decodeSegments (tBitString, s, true);
+  if (d.failed())
+    return d;
+
+  v.assign (s.contiguous (tmp), s.total_length() * 8 - s.unused_bits());
   return d;
 }
 
 inline BERDecoder &null(BERDecoder &d) {
-  d.expectTag (tNull);
-  uint32 len = d.decodeLength();
+  size_t len = d.expectHeader (tNull);
   if (len != 0)
-    throw std::runtime_error("expected zero length for a Null");
+    d.fail (BERDecoder::BAD_VALUE, "expected zero length for a Null");
   return d;
 }
 
 /* BERDecoder d;
-   ASN1::T61String name;
+   asn1::T61String name;
    bool flag;
 
-   d >> ASN1::sequence >> name >> flag >> ASN1::end;
+   d >> asn1::sequence >> name >> flag >> asn1::end;
 
-   d >> ASN1::set >> name >> flag >> ASN1::end;
+   d >> asn1::set >> name >> flag >> asn1::end;
 
-   d >> ASN1::set;
+   d >> asn1::set;
    while (!d.atEnd()) {
      d >> name;
    }
-   d >> ASN1::end;
+   d >> asn1::end;
 */
 inline BERDecoder &sequence(BERDecoder &d) {
-  d.expectTag (tSequence, CONSTRUCTED);
-  bool indefinite = false;
-  uint32 len = d.decodeLengthOrIndefinite (indefinite);
+  bool indefinite;
+  size_t len = d.expectHeader (tSequence, CONSTRUCTED, indefinite);
 
   d.pushState (indefinite, len);
   return d;
 }
 
 inline BERDecoder &set(BERDecoder &d) {
-  d.expectTag (tSet, CONSTRUCTED);
-  bool indefinite, false;
-  uint32 len = d.decodeLengthOrIndefinite (indefinite);
+  bool indefinite;
+  size_t len = d.expectHeader (tSet, CONSTRUCTED, indefinite);
 
   d.pushState (indefinite, len);
   return d;
@@ -605,7 +1180,7 @@ inline BERDecoder &set(BERDecoder &d) {
 
 inline BERDecoder &end(BERDecoder &d) {
   if (!d.atEnd())
-    throw std::runtime_error("expected end, got more octets");
+    d.fail (BERDecoder::EXPECTED_END, "expected end, got more octets");
   if (d.inIndefinite())
     d.expectEndOfContents();
   d.popState ();
@@ -619,41 +1194,94 @@ inline BERDecoder &end(BERDecoder &d) {
 
    is equivalent do
 
-   d >> ASN1::sequence >> v[0] >> v[1] >> ... >> v[n] >> ASN1::end;
+   d >> asn1::sequence >> v[0] >> v[1] >> ... >> v[n] >> asn1::end;
 
    Similarly for std::list and std::deque.
 */
 template <class T, class A=std::allocator<T> >
 BERDecoder &operator>> (BERDecoder &d, std::vector<T, A>  &v) {
-  d >> ASN1::sequence;
+  d >> asn1::sequence;
   while (!d.atEnd()) {
     T val;
     d >> val;
     v.push_back(val);
   }
-  d >> ASN1::end;
+  d >> asn1::end;
+  return d;
+}
+
+/* SEQUENCE OF INTEGER and BOOLEAN are decoded in bulk, since large arrays
+   of counters are common and the per-element overhead of the generic
+   version dominates.  The bulk loop hands anything it doesn't handle to
+   the ordinary element decoder, so the results (and errors) are the
+   same. */
+template <class Int, class A>
+BERDecoder &decodeIntegerSequence (BERDecoder &d, std::vector<Int, A> &v) {
+  d >> sequence;
+  for (;;) {
+    d.decodeIntegerRun<Int> (0x02, v, [](Int i) { return i; });
+    if (d.atEnd())
+      break;
+    Int val;
+    d >> val;
+    v.push_back(val);
+  }
+  d >> end;
   return d;
 }
+
+template <class A>
+BERDecoder &operator>> (BERDecoder &d, std::vector<int32, A> &v) {
+  return decodeIntegerSequence (d, v);
+}
+template <class A>
+BERDecoder &operator>> (BERDecoder &d, std::vector<uint32, A> &v) {
+  return decodeIntegerSequence (d, v);
+}
+template <class A>
+BERDecoder &operator>> (BERDecoder &d, std::vector<int64, A> &v) {
+  return decodeIntegerSequence (d, v);
+}
+template <class A>
+BERDecoder &operator>> (BERDecoder &d, std::vector<uint64, A> &v) {
+  return decodeIntegerSequence (d, v);
+}
+
+template <class A>
+BERDecoder &operator>> (BERDecoder &d, std::vector<bool, A> &v) {
+  d >> sequence;
+  for (;;) {
+    d.decodeBooleanRun (v);
+    if (d.atEnd())
+      break;
+    bool val;
+    d >> val;
+    v.push_back(val);
+  }
+  d >> end;
+  return d;
+}
+
 template <class T, class A=std::allocator<T> >
 BERDecoder &operator>> (BERDecoder &d, std::list<T, A>  &v) {
-  d >> ASN1::sequence;
+  d >> asn1::sequence;
   while (!d.atEnd()) {
     T val;
     d >> val;
     v.push_back(val);
   }
-  d >> ASN1::end;
+  d >> asn1::end;
   return d;
 }
 template <class T, class A=std::allocator<T> >
 BERDecoder &operator>> (BERDecoder &d, std::deque<T, A>  &v) {
-  d >> ASN1::sequence;
+  d >> asn1::sequence;
   while (!d.atEnd()) {
     T val;
     d >> val;
     v.push_back(val);
   }
-  d >> ASN1::end;
+  d >> asn1::end;
   return d;
 }
 
@@ -664,17 +1292,17 @@ BERDecoder &operator>> (BERDecoder &d, std::deque<T, A>  &v) {
 
    is equivalent to
 
-   d >> ASN1::set >> s[0] >> s[1] >> ... >> s[n] >> ASN1::end
+   d >> asn1::set >> s[0] >> s[1] >> ... >> s[n] >> asn1::end
 */
 template <class T, class A=std::allocator<T> >
 BERDecoder &operator>> (BERDecoder &d, std::set<T, A>  &v) {
-  d >> ASN1::sequence;
+  d >> asn1::set;
   while (!d.atEnd()) {
     T val;
     d >> val;
-    s.insert(val);
+    v.insert(val);
   }
-  d >> ASN1::end;
+  d >> asn1::end;
   return d;
 }
 
@@ -685,12 +1313,12 @@ BERDecoder &operator>> (BERDecoder &d, std::set<T, A>  &v) {
 
    is equivalent to
 
-   d >> ASN1::set
-       >> ASN1::sequence >> key[0] >> value[0] >> ASN1:end
-       >> ASN1::sequence >> key[1] >> value[1] >> ASN1:end
+   d >> asn1::set
+       >> asn1::sequence >> key[0] >> value[0] >> asn1::end
+       >> asn1::sequence >> key[1] >> value[1] >> asn1::end
        >> ...
-       >> ASN1::sequence >> key[n] >> value[n] >> ASN1:end
-     >> ASN1::end;
+       >> asn1::sequence >> key[n] >> value[n] >> asn1::end
+     >> asn1::end;
 
    Similarly for std::multimap.
 */
@@ -698,180 +1326,178 @@ template <class Key, class T, class Compare=std::less<Key>,
           class A=std::allocator<std::pair<const Key, T> > >
 BERDecoder &operator>> (BERDecoder &d, std::map<Key, T, Compare, A> &m)
 {
-  d >> ASN1::set;
+  d >> asn1::set;
   while (!d.atEnd()) {
     Key k;
     T v;
-    d >> ASN1::sequence >> k >> v >> ASN1::end;
+    d >> asn1::sequence >> k >> v >> asn1::end;
     m.emplace(k, v);
   }
-  d >> ASN1::end;
+  d >> asn1::end;
   return d;
 }
 template <class Key, class T, class Compare=std::less<Key>,
           class A=std::allocator<std::pair<const Key, T> > >
 BERDecoder &operator>> (BERDecoder &d, std::multimap<Key, T, Compare, A> &m)
 {
-  d >> ASN1::set;
+  d >> asn1::set;
   while (!d.atEnd()) {
     Key k;
     T v;
-    d >> ASN1::sequence >> k >> v >> ASN1::end;
+    d >> asn1::sequence >> k >> v >> asn1::end;
     m.emplace(k, v);
   }
-  d >> ASN1::end;
+  d >> asn1::end;
   return d;
 }
 
 inline BERDecoder &operator>> (BERDecoder &d, OID &o)
 {
-  d.expectTag (tOID);
-  uint32 len = d.decodeLength();
-
-  d.pushState (false, len);
-
-  unsigned subid = d.getTBF();
+  size_t len = d.expectHeader (tOID);
 
+  // The first subidentifier holds the first two arcs (X.690 8.19.4)
   o.clear();
-  o.push_back(subid / 40);
-  o.push_back(subid % 40);
+  o.push_back(0);
+  d.decodeTBFs (len, o);
 
-  while (!d.atEnd())
-    o.push_back(d.getTBF());
+  if (o.size() < 2) {
+    o.clear();
+    return d;
+  }
 
-  d.popState();
+  uint32 subid = o[1];
+  uint32 first = subid < 80 ? subid / 40 : 2;
+
+  o[0] = first;
+  o[1] = subid - first * 40;
 
   return d;
 }
 
 inline BERDecoder &operator>> (BERDecoder &d, RelativeOID &o)
 {
-  d.expectTag (tRelativeOID);
-  uint32 len = d.decodeLength();
-
-  d.pushState (false, len);
+  size_t len = d.expectHeader (tRelativeOID);
 
   o.clear();
-  while (!d.atEnd())
-    o.push_back(d.getTBF());
-
-  d.popState();
+  d.decodeTBFs (len, o);
 
   return d;
 }
 
 // String types
-inline BERDecoder &operator>> (BERDecoder &d, const BMPString &bmp) {
-  d.expectTag (tBMPString);
-  uint32 len = d.decodeLength();
-
-  if (len & 1)
-    throw std::runtime_error("BMP string must have even number of octets");
+inline BERDecoder &operator>> (BERDecoder &d, BMPString &bmp) {
+  octet_segments s;
+  std::vector<octet> tmp;
 
-  len >>= 1;
-
-  bmp.clear();
-  while (len--)
-    bmp.push_back (d.get16());
-  
-  return d;
-}
+  d.decodeSegments (tBMPString, s);
+  if (d.failed())
+    return d;
 
-inline BERDecoder &operator>> (BERDecoder &d, const UniversalString &us) {
-  d.expectTag (tUniversalString);
-  uint32 len = d.decodeLength();
+  size_t len = s.total_length();
 
-  if (len & 3)
-    throw std::runtime_error("Universal string must have a multiple of four octets");
+  if (len & 1) {
+    d.fail (BERDecoder::BAD_VALUE,
+            "BMP string must have even number of octets");
+    return d;
+  }
 
-  len >>= 2;
+  const octet *p = s.contiguous (tmp);
 
-  us.clear();
-  while (len--)
-    us.push_back (d.get32());
+  bmp.clear();
+  bmp.reserve (len >> 1);
+  for (size_t n = 0; n < len; n += 2)
+    bmp.push_back ((p[n] << 8) | p[n + 1]);
 
   return d;
 }
 
-inline BERDecoder &operator>> (BERDecoder &d, const GeneralString &gs) {
-  d.expectTag (tGeneralString);
-  uint32 len = d.decodeLength();
+inline BERDecoder &operator>> (BERDecoder &d, UniversalString &us) {
+  octet_segments s;
+  std::vector<octet> tmp;
 
-  gs.assign (d.getOctets(len), len);
-
-  return d;
-}
-
-inline BERDecoder &operator>> (BERDecoder &d, const GraphicString &gs) {
-  d.expectTag (tGraphicString);
-  uint32 len = d.decodeLength();
+  d.decodeSegments (tUniversalString, s);
+  if (d.failed())
+    return d;
 
-  gs.assign (d.getOctets(len), len);
+  size_t len = s.total_length();
 
-  return d;
-}
+  if (len & 3) {
+    d.fail (BERDecoder::BAD_VALUE,
+            "Universal string must have a multiple of four octets");
+    return d;
+  }
 
-inline BERDecoder &operator>> (BERDecoder &d, const IA5String &ia5) {
-  d.expectTag (tIA5String);
-  uint32 len = d.decodeLength();
+  const octet *p = s.contiguous (tmp);
 
-  ia5.assign (d.getOctets(len), len);
+  us.clear();
+  us.reserve (len >> 2);
+  for (size_t n = 0; n < len; n += 4)
+    us.push_back ((uint32(p[n]) << 24) | (uint32(p[n + 1]) << 16)
+                  | (uint32(p[n + 2]) << 8) | p[n + 3]);
 
   return d;
 }
 
-inline BERDecoder &operator>> (BERDecoder &d, const NumericString &ns) {
-  d.expectTag (tNumericString);
-  uint32 len = d.decodeLength();
-
-  ns.assign (d.getOctets(len), len);
-
+// Views of the 8-bit string types (see string_view.h)
+template <class String>
+BERDecoder &operator>> (BERDecoder &d, string_view<String> &sv) {
+  if (d.expectStringTag (traits<String>::tag) == CONSTRUCTED) {
+    d.fail (BERDecoder::UNSUPPORTED,
+            "cannot view a constructed string; use octet_segments");
+    return d;
+  }
+  size_t len = d.decodeLength();
+  const octet *ptr = d.getOctets (len);
+  sv = string_view<String> (reinterpret_cast<const char *>(ptr),
+                            ptr ? len : 0);
   return d;
 }
 
-inline BERDecoder &operator>> (BERDecoder &d, const PrintableString &ps) {
-  d.expectTag (tPrintableString);
-  uint32 len = d.decodeLength();
-
-  ps.assign (d.getOctets(len), len);
-
+/* The 8-bit string types, in either form.  Unlike the views above, these
+   copy the value into the string. */
+template <class String>
+BERDecoder &decodeString (BERDecoder &d, Tag t, String &str) {
+  octet_segments s;
+  d.decodeSegments (t, s);
+  str.clear();
+  s.coalesce (str);
   return d;
 }
 
-inline BERDecoder &operator>> (BERDecoder &d, const T61String &t61) {
-  d.expectTag (tT61String);
-  uint32 len = d.decodeLength();
-
-  t61.assign (d.getOctets(len), len);
-
-  return d;
+inline BERDecoder &operator>> (BERDecoder &d, GeneralString &gs) {
+  return decodeString (d, tGeneralString, gs);
 }
 
-inline BERDecoder &operator>> (BERDecoder &d, const UTF8String &us) {
-  d.expectTag (tUTF8String);
-  uint32 len = d.decodeLength();
-
-  us.assign (d.getOctets(len), len);
+inline BERDecoder &operator>> (BERDecoder &d, GraphicString &gs) {
+  return decodeString (d, tGraphicString, gs);
+}
 
-  return d;
+inline BERDecoder &operator>> (BERDecoder &d, IA5String &ia5) {
+  return decodeString (d, tIA5String, ia5);
 }
 
-inline BERDecoder &operator>> (BERDecoder &d, const VideotexString &vs) {
-  d.expectTag (tVideotexString);
-  uint32 len = d.decodeLength();
+inline BERDecoder &operator>> (BERDecoder &d, NumericString &ns) {
+  return decodeString (d, tNumericString, ns);
+}
 
-  vs.assign (d.getOctets(len), len);
+inline BERDecoder &operator>> (BERDecoder &d, PrintableString &ps) {
+  return decodeString (d, tPrintableString, ps);
+}
 
-  return d;
+inline BERDecoder &operator>> (BERDecoder &d, T61String &t61) {
+  return decodeString (d, tT61String, t61);
 }
 
-inline BERDecoder &operator>> (BERDecoder &d, const ISO646String &is) {
-  d.expectTag (tISO646String);
-  uint32 len = d.decodeLength();
+inline BERDecoder &operator>> (BERDecoder &d, UTF8String &us) {
+  return decodeString (d, tUTF8String, us);
+}
 
-  is.assign (d.getOctets(len), len);
+inline BERDecoder &operator>> (BERDecoder &d, VideotexString &vs) {
+  return decodeString (d, tVideotexString, vs);
+}
 
-  return d;
+inline BERDecoder &operator>> (BERDecoder &d, ISO646String &is) {
+  return decodeString (d, tISO646String, is);
 }
 
 // ###TODO: Support instance_of() and enumerated() manipulators
@@ -0,0 +1,119 @@
+/* Emacs, this is -*-C++-*- */
+
+#ifndef ASN1_BERSTREAMDECODER_H_
+#define ASN1_BERSTREAMDECODER_H_
+
+#include "base.h"
+#include "Tag.h"
+
+#include <vector>
+
+BEGIN_ASN1_NS
+
+/* A resumable, push-mode BER parser.  BERDecoder needs the whole PDU in
+   one contiguous buffer; this class instead accepts whatever arrives from
+   recv() and keeps its place between calls, reporting what it finds to a
+   handler as it goes, e.g.
+
+     asn1::BERStreamDecoder d(my_handler);
+
+     for (;;) {
+       ssize_t n = recv (fd, buf, sizeof (buf), 0);
+       const asn1::octet *p = buf;
+       size_t consumed;
+
+       while (n > 0) {
+         if (d.feed (p, n, consumed) == asn1::BERStreamDecoder::COMPLETE)
+           pdu_done ();
+         p += consumed;
+         n -= consumed;
+       }
+     }
+
+   feed() stops at the end of each top-level TLV, so bytes belonging to
+   the next PDU are left for the next call.  Running out of input is not
+   an error; malformed input throws std::runtime_error. */
+class BERStreamDecoder
+{
+public:
+  class handler {
+  public:
+    virtual ~handler() {}
+
+    // len is zero if the value uses the indefinite form
+    virtual void beginConstructed (Tag t, bool indefinite, size_t len) = 0;
+    virtual void endConstructed (Tag t) = 0;
+
+    /* The contents pointer is only valid for the duration of the call.
+       If the contents arrived in a single chunk, it points straight into
+       that chunk; otherwise it points at an internal staging area. */
+    virtual void primitive (Tag t, const octet *data, size_t len) = 0;
+  };
+
+  typedef enum {
+    NEED_MORE_DATA = 0,
+    COMPLETE = 1
+  } status;
+
+private:
+  typedef enum {
+    TAG,
+    TAG_NUMBER,
+    LENGTH,
+    LENGTH_MORE,
+    CONTENTS,
+    END_OF_CONTENTS,
+    DONE
+  } Phase;
+
+  struct State {
+    Tag    tag;
+    bool   indefinite;
+    size_t end;         // Offset of the end of the nearest definite value
+
+    State(Tag t, bool i, size_t e) : tag(t), indefinite(i), end(e) {}
+  };
+
+  handler            &_handler;
+
+  Phase               _phase;
+  size_t              _offset;
+  std::vector<State>  _stack;
+  std::vector<octet>  _pending;
+
+  // The header currently being decoded
+  TagClass            _tag_class;
+  bool                _constructed;
+  uint32              _number;
+  unsigned            _count;
+  bool                _indefinite;
+  size_t              _length;
+
+  size_t limit() const {
+    return _stack.empty() ? ~static_cast<size_t>(0) : _stack.back().end;
+  }
+
+  void checkHeaderOctet();
+  void headerDone();
+  void elementDone();
+
+public:
+  BERStreamDecoder(handler &h) : _handler(h) {
+    reset();
+  }
+
+  /* Consume up to len octets of input.  Sets consumed to the number of
+     octets actually used, which is less than len only when the status is
+     COMPLETE and the chunk holds the start of another PDU. */
+  status feed(const octet *data, size_t len, size_t &consumed);
+
+  // Discard any partially decoded PDU
+  void reset();
+
+  // True if a PDU has been started but not yet finished
+  bool inProgress() const { return _offset != 0; }
+};
+
+END_ASN1_NS
+
+#endif /* ASN1_BERSTREAMDECODER_H_ */
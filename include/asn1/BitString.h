@@ -56,6 +56,8 @@ private:
   }
 
 public:
+  explicit BitString(const allocator_type &alloc=allocator_type())
+    : _storage(alloc), _len(0) { }
   BitString(const BitString &other) 
     : _storage(other._storage), _len(other._len) { }
   BitString(const BitString &other, const allocator_type &alloc) 
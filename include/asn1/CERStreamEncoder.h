@@ -0,0 +1,582 @@
+/* Emacs, this is -*-C++-*- */
+
+#ifndef ASN1_CERSTREAMENCODER_H_
+#define ASN1_CERSTREAMENCODER_H_
+
+#include "base.h"
+#include "Tag.h"
+#include "BitString.h"
+#include "OID.h"
+#include "buffer.h"
+#include "strings.h"
+#include "set_order.h"
+#include "sink.h"
+#include "DEREncoder.h"
+
+#include <vector>
+#include <list>
+#include <deque>
+#include <set>
+#include <cstring>
+
+BEGIN_ASN1_NS
+
+/* A CER (X.690 9) encoder that streams its output to a sink.
+
+   CER gives every constructed value an indefinite length, and splits
+   strings longer than 1000 octets into 1000-octet segments, so nothing
+   has to be measured before it is written.  Output is staged in a buffer
+   and passed to the sink whenever that fills, which keeps memory use flat
+   however long a SEQUENCE OF gets; large strings go to the sink without
+   being staged at all.  The exception is a SET, whose items have to be
+   sorted and so are held until the SET ends.
+
+     asn1::fd_sink out (fd);
+     asn1::CERStreamEncoder e (out);
+
+     e << asn1::sequence;
+     while (more())
+       e << next();
+     e << asn1::end;
+     e.flush();
+
+   Nothing is written until the staging buffer fills, so call flush() when
+   done; the destructor doesn't, since it can't report errors. */
+class CERStreamEncoder
+{
+public:
+  typedef asn1::buffer<asn1::big_endian> buffer;
+
+  typedef enum {
+    SEQUENCE = 0,
+    SET = 1
+  } PushMode;
+
+  // CER puts at most this many contents octets in each string segment
+  static const size_t segment_size = 1000;
+
+private:
+  struct State {
+    bool                in_set;
+    bool                pins;       // Outermost SET, so it set _pin
+    size_t              start;      // Where the contents start in _buf
+    std::vector<size_t> set_items;  // Where each SET item starts in _buf
+
+    State() : in_set(false), pins(false), start(0) {}
+  };
+
+  bool                   _replace_next_tag;
+  Tag                    _next_tag;
+  PrimitiveOrConstructed _next_tag_constructed;
+
+  sink               &_sink;
+  buffer              _buf;
+  size_t              _threshold;
+  size_t              _pin;         // Nothing from here on can be written
+  std::vector<State>  _stack;
+
+  static const size_t npos = ~size_t(0);
+
+  // Write out everything before _pin
+  void flushStaged() {
+    size_t len = _pin == npos ? _buf.length() : _pin;
+
+    if (!len)
+      return;
+
+    _sink.write (_buf.data(), len);
+
+    size_t rest = _buf.length() - len;
+    if (rest)
+      std::memmove (_buf.data(), _buf.data() + len, rest);
+    _buf.truncate (rest);
+
+    if (_pin != npos) {
+      // Everything still staged is inside a SET; its offsets move down
+      _pin -= len;
+      for (auto i = _stack.begin(); i < _stack.end(); ++i) {
+        if (i->start >= len)
+          i->start -= len;
+        for (auto j = i->set_items.begin(); j < i->set_items.end(); ++j)
+          *j -= len;
+      }
+    }
+  }
+
+  void maybeFlush() {
+    size_t len = _pin == npos ? _buf.length() : _pin;
+    if (len >= _threshold)
+      flushStaged ();
+  }
+
+  // Start a new element, applying any tag override
+  void beginElement(Tag &t, PrimitiveOrConstructed &c) {
+    maybeFlush ();
+
+    if (_stack.back().in_set)
+      _stack.back().set_items.push_back (_buf.length());
+
+    if (_replace_next_tag) {
+      t = _next_tag;
+      c = _next_tag_constructed;
+      _replace_next_tag = false;
+    }
+  }
+
+  void encodeIdentifier(Tag t, PrimitiveOrConstructed c) {
+    octet pc = c ? 0x20 : 0;
+
+    if (t.number < 31) {
+      encodeOctet ((t.tagClass << 6) | pc | t.number);
+      return;
+    }
+
+    octet tbf[5];
+    unsigned n = putTBF (tbf, t.number);
+
+    encodeOctet ((t.tagClass << 6) | pc | 0x1f);
+    _buf.put_octets (tbf, n);
+  }
+
+  // The segmented form is constructed whatever the tag
+  void encodeConstructedString(Tag t) {
+    PrimitiveOrConstructed c = CONSTRUCTED;
+
+    beginElement (t, c);
+    encodeIdentifier (t, CONSTRUCTED);
+    encodeOctet (0x80);
+  }
+
+  void encodeEndOfContents() {
+    _buf.put_uint16 (0);
+  }
+
+  void sortSet(State &s) {
+    std::vector<set_item> order;
+    size_t count = s.set_items.size();
+    size_t end = _buf.length();
+    size_t first = count ? s.set_items.front() : end;
+
+    if (first > s.start)
+      order.push_back ({ s.start, first - s.start });
+    for (size_t n = 0; n < count; ++n) {
+      size_t next = n + 1 < count ? s.set_items[n + 1] : end;
+      order.push_back ({ s.set_items[n], next - s.set_items[n] });
+    }
+
+    set_item *items = order.data() + (first > s.start);
+    sort_set_items (_buf.data(), items, order.data() + order.size());
+
+    bool sorted = true;
+    for (size_t n = 1; n < order.size(); ++n) {
+      if (order[n].offset < order[n - 1].offset)
+        sorted = false;
+    }
+    if (sorted)
+      return;
+
+    std::vector<octet> copy (_buf.data() + s.start, _buf.data() + end);
+    octet *p = _buf.data() + s.start;
+    for (auto i = order.begin(); i < order.end(); ++i) {
+      std::memcpy (p, copy.data() + (i->offset - s.start), i->length);
+      p += i->length;
+    }
+  }
+
+public:
+  CERStreamEncoder(sink &out, size_t staging = 65536,
+                   allocator &alloc = dynamic_allocator)
+    : _replace_next_tag(false), _sink(out), _buf(alloc),
+      _threshold(staging), _pin(npos), _stack(1, State()) {
+    _buf.reserve (staging);
+  }
+
+  CERStreamEncoder(const CERStreamEncoder &) = delete;
+  CERStreamEncoder &operator=(const CERStreamEncoder &) = delete;
+
+  // Write w base-128 to p (which has room for five), returning the length
+  static unsigned putTBF(octet *p, uint32 w) {
+    unsigned n = 1;
+    for (uint32 v = w >> 7; v; v >>= 7)
+      ++n;
+    for (unsigned i = n; i-- > 0; w >>= 7)
+      p[i] = (w & 0x7f) | (i == n - 1 ? 0 : 0x80);
+    return n;
+  }
+
+  void overrideNextTag(const Tag t, PrimitiveOrConstructed c)
+  {
+    if (!_replace_next_tag) {
+      _replace_next_tag = true;
+      _next_tag = t;
+      _next_tag_constructed = c;
+    }
+  }
+
+  /* Pass everything encoded so far to the sink, except anything inside a
+     SET that hasn't ended yet */
+  void flush() { flushStaged (); }
+
+  void encodeOctet(octet o) { _buf.put_octet (o); }
+  void encodeOctets(const octet *o, size_t len) {
+    // Big runs go straight to the sink, unless a SET needs them staged
+    if (len >= _threshold && _pin == npos) {
+      flushStaged ();
+      _sink.write (o, len);
+      return;
+    }
+    if (len)
+      _buf.put_octets (o, len);
+  }
+
+  void encodeTag(Tag t, PrimitiveOrConstructed c = PRIMITIVE) {
+    beginElement (t, c);
+    encodeIdentifier (t, c);
+  }
+
+  void encodeLength(size_t len) {
+    if (len <= 0x7f) {
+      encodeOctet (len);
+      return;
+    }
+
+    octet count = 0;
+    for (size_t l = len; l; l >>= 8)
+      ++count;
+    encodeOctet (0x80 | count);
+    while (count--)
+      encodeOctet (len >> (8 * count));
+  }
+
+  void encodeHeader(Tag t, size_t len, PrimitiveOrConstructed c = PRIMITIVE) {
+    encodeTag (t, c);
+    encodeLength (len);
+  }
+
+  /* Encode a string type's contents: primitive if there are no more than
+     1000 octets, otherwise constructed with an indefinite length and
+     1000-octet OCTET STRING segments (X.690 9.2, 8.23.6) */
+  void encodeString(Tag t, const octet *data, size_t len) {
+    if (len <= segment_size) {
+      encodeHeader (t, len);
+      encodeOctets (data, len);
+      return;
+    }
+
+    encodeConstructedString (t);
+    while (len) {
+      size_t chunk = len < segment_size ? len : segment_size;
+
+      maybeFlush ();
+      encodeIdentifier (tOctetString, PRIMITIVE);
+      encodeLength (chunk);
+      encodeOctets (data, chunk);
+      data += chunk;
+      len -= chunk;
+    }
+    encodeEndOfContents ();
+  }
+
+  /* A BIT STRING of bits bits; its segments are BIT STRINGs, and all but
+     the last have no unused bits (X.690 9.2, 8.6.4) */
+  void encodeBitString(Tag t, const octet *data, size_t bits) {
+    size_t bytes = (bits + 7) >> 3;
+    octet unused = (8 - (bits & 7)) & 7;
+
+    if (bytes + 1 <= segment_size) {
+      encodeHeader (t, bytes + 1);
+      encodeOctet (unused);
+      encodeOctets (data, bytes);
+      return;
+    }
+
+    encodeConstructedString (t);
+    while (bytes) {
+      size_t chunk = bytes < segment_size - 1 ? bytes : segment_size - 1;
+
+      maybeFlush ();
+      encodeIdentifier (tBitString, PRIMITIVE);
+      encodeLength (chunk + 1);
+      encodeOctet (chunk == bytes ? unused : 0);
+      encodeOctets (data, chunk);
+      data += chunk;
+      bytes -= chunk;
+    }
+    encodeEndOfContents ();
+  }
+
+  void encodeInteger(int64 i) {
+    uint64 w = machine::to_be (uint64(i));
+    unsigned len = DEREncoder::integerLength (i);
+
+    encodeHeader (tInteger, len);
+    encodeOctets ((const octet *)&w + 8 - len, len);
+  }
+  void encodeInteger(uint64 u) {
+    uint64 w = machine::to_be (u);
+    unsigned len = DEREncoder::integerLength (u);
+
+    encodeHeader (tInteger, len);
+    if (len > 8) {
+      encodeOctet (0);
+      --len;
+    }
+    encodeOctets ((const octet *)&w + 8 - len, len);
+  }
+
+  /* Start a constructed value; CER always gives these an indefinite
+     length, so popState() just writes the end-of-contents octets */
+  void pushState(PushMode p) {
+    State st;
+
+    encodeOctet (0x80);
+    st.in_set = p == SET;
+    st.start = _buf.length();
+    if (st.in_set && _pin == npos) {
+      st.pins = true;
+      _pin = st.start;
+    }
+    _stack.push_back (std::move(st));
+  }
+  void popState() {
+    if (_stack.size() < 2)
+      throw std::runtime_error("Unbalanced ASN1::end in CER encoding");
+
+    State &s = _stack.back();
+    if (s.in_set)
+      sortSet (s);
+    if (s.pins)
+      _pin = npos;
+    _stack.pop_back();
+    encodeEndOfContents ();
+  }
+
+  // True if every constructed value has been ended
+  bool complete() const { return _stack.size() == 1; }
+
+  /* Encode v with DEREncoder and copy it in.  That's only right where DER
+     and CER agree, which for our purposes means primitive encodings, so
+     we check. */
+  template <class T>
+  void encodeForward(const T &v) {
+    buffer b;
+    {
+      DEREncoder e (b);
+      e << v;
+      e.asDER();
+    }
+    if (b.length() && (b.data()[0] & 0x20))
+      throw std::runtime_error("No CER encoding for this constructed type");
+
+    bool retag = _replace_next_tag;
+    PrimitiveOrConstructed c = PRIMITIVE;
+    Tag t = tNull;
+
+    beginElement (t, c);
+    if (retag) {
+      // Re-encode with the overridden tag
+      const octet *p = b.data();
+      size_t n = 1;
+      if ((p[0] & 0x1f) == 0x1f) {
+        while (p[n] & 0x80)
+          ++n;
+        ++n;
+      }
+      encodeIdentifier (t, c);
+      encodeOctets (p + n, b.length() - n);
+    } else {
+      encodeOctets (b.data(), b.length());
+    }
+  }
+};
+
+inline CERStreamEncoder &operator<< (CERStreamEncoder &e, bool b) {
+  e.encodeHeader (tBoolean, 1);
+  e.encodeOctet (b ? 0xff : 0x00);
+  return e;
+}
+
+inline CERStreamEncoder &operator<< (CERStreamEncoder &e, int32 i) {
+  e.encodeInteger (int64(i));
+  return e;
+}
+
+inline CERStreamEncoder &operator<< (CERStreamEncoder &e, uint32 i) {
+  e.encodeInteger (uint64(i));
+  return e;
+}
+
+inline CERStreamEncoder &operator<< (CERStreamEncoder &e, int64 i) {
+  e.encodeInteger (i);
+  return e;
+}
+
+inline CERStreamEncoder &operator<< (CERStreamEncoder &e, uint64 i) {
+  e.encodeInteger (i);
+  return e;
+}
+
+template <class A>
+CERStreamEncoder &operator<< (CERStreamEncoder &e,
+                              const std::vector<octet, A> &v) {
+  e.encodeString (tOctetString, v.data(), v.size());
+  return e;
+}
+
+inline CERStreamEncoder &operator<< (CERStreamEncoder &e, const octet_ref &r) {
+  e.encodeString (tOctetString, r.data(), r.size());
+  return e;
+}
+
+template <class A>
+CERStreamEncoder &operator<< (CERStreamEncoder &e, const BitString<A> &v) {
+  e.encodeBitString (tBitString, v.data(), v.size());
+  return e;
+}
+
+inline CERStreamEncoder &operator<< (CERStreamEncoder &e, const OID &o) {
+  std::vector<octet> contents;
+  octet tbf[5];
+
+  contents.insert (contents.end(), tbf, tbf + CERStreamEncoder::putTBF (tbf, o[0] * 40 + o[1]));
+  for (auto i = o.begin() + 2; i < o.end(); ++i)
+    contents.insert (contents.end(), tbf, tbf + CERStreamEncoder::putTBF (tbf, *i));
+
+  e.encodeHeader (tOID, contents.size());
+  e.encodeOctets (contents.data(), contents.size());
+  return e;
+}
+
+inline CERStreamEncoder &operator<< (CERStreamEncoder &e,
+                                     const RelativeOID &o) {
+  std::vector<octet> contents;
+  octet tbf[5];
+
+  for (auto i = o.begin(); i < o.end(); ++i)
+    contents.insert (contents.end(), tbf, tbf + CERStreamEncoder::putTBF (tbf, *i));
+
+  e.encodeHeader (tRelativeOID, contents.size());
+  e.encodeOctets (contents.data(), contents.size());
+  return e;
+}
+
+// Octet-per-character string types
+#define ASN1_CER_STRING(Type, t)                                        \
+  inline CERStreamEncoder &operator<< (CERStreamEncoder &e,             \
+                                       const Type &s) {                 \
+    e.encodeString (t, (const octet *)s.data(), s.length());            \
+    return e;                                                           \
+  }
+
+ASN1_CER_STRING(GeneralString, tGeneralString)
+ASN1_CER_STRING(GraphicString, tGraphicString)
+ASN1_CER_STRING(IA5String, tIA5String)
+ASN1_CER_STRING(NumericString, tNumericString)
+ASN1_CER_STRING(PrintableString, tPrintableString)
+ASN1_CER_STRING(T61String, tT61String)
+ASN1_CER_STRING(UTF8String, tUTF8String)
+ASN1_CER_STRING(VideotexString, tVideotexString)
+ASN1_CER_STRING(ISO646String, tISO646String)
+
+#undef ASN1_CER_STRING
+
+inline CERStreamEncoder &operator<< (CERStreamEncoder &e,
+                                     const BMPString &bmp) {
+  std::vector<octet> contents;
+  contents.reserve (bmp.length() * 2);
+  for (auto p = bmp.begin(); p != bmp.end(); ++p) {
+    contents.push_back (uint16(*p) >> 8);
+    contents.push_back (uint16(*p) & 0xff);
+  }
+  e.encodeString (tBMPString, contents.data(), contents.size());
+  return e;
+}
+
+inline CERStreamEncoder &operator<< (CERStreamEncoder &e,
+                                     const UniversalString &us) {
+  std::vector<octet> contents;
+  contents.reserve (us.length() * 4);
+  for (auto p = us.begin(); p != us.end(); ++p) {
+    uint32 c = *p;
+    contents.push_back (c >> 24);
+    contents.push_back ((c >> 16) & 0xff);
+    contents.push_back ((c >> 8) & 0xff);
+    contents.push_back (c & 0xff);
+  }
+  e.encodeString (tUniversalString, contents.data(), contents.size());
+  return e;
+}
+
+// SEQUENCE OF and SET OF, as for DEREncoder
+template <class T, class A=std::allocator<T> >
+CERStreamEncoder &operator<< (CERStreamEncoder &e, const std::vector<T, A> &v) {
+  e.encodeTag (tSequence, CONSTRUCTED);
+  e.pushState (CERStreamEncoder::SEQUENCE);
+  for (auto i = v.begin(); i < v.end(); ++i)
+    e << *i;
+  e.popState ();
+  return e;
+}
+template <class T, class A=std::allocator<T> >
+CERStreamEncoder &operator<< (CERStreamEncoder &e, const std::list<T, A> &v) {
+  e.encodeTag (tSequence, CONSTRUCTED);
+  e.pushState (CERStreamEncoder::SEQUENCE);
+  for (auto i = v.begin(); i != v.end(); ++i)
+    e << *i;
+  e.popState ();
+  return e;
+}
+template <class T, class A=std::allocator<T> >
+CERStreamEncoder &operator<< (CERStreamEncoder &e, const std::deque<T, A> &v) {
+  e.encodeTag (tSequence, CONSTRUCTED);
+  e.pushState (CERStreamEncoder::SEQUENCE);
+  for (auto i = v.begin(); i < v.end(); ++i)
+    e << *i;
+  e.popState ();
+  return e;
+}
+template <class T, class Compare=std::less<T>, class A=std::allocator<T> >
+CERStreamEncoder &operator<< (CERStreamEncoder &e,
+                              const std::set<T, Compare, A> &v) {
+  e.encodeTag (tSet, CONSTRUCTED);
+  e.pushState (CERStreamEncoder::SET);
+  for (auto i = v.begin(); i != v.end(); ++i)
+    e << *i;
+  e.popState ();
+  return e;
+}
+
+// Everything else (REAL, ENUMERATED...) has the same encoding as in DER
+template <class T>
+CERStreamEncoder &operator<< (CERStreamEncoder &e, const T &v) {
+  e.encodeForward (v);
+  return e;
+}
+
+// The DEREncoder manipulators: sequence, set, end and null
+inline CERStreamEncoder &operator<< (CERStreamEncoder &e,
+                                     DEREncoder &(*pf)(DEREncoder &)) {
+  typedef DEREncoder &(*manipulator)(DEREncoder &);
+
+  if (pf == static_cast<manipulator>(sequence)) {
+    e.encodeTag (tSequence, CONSTRUCTED);
+    e.pushState (CERStreamEncoder::SEQUENCE);
+  } else if (pf == static_cast<manipulator>(set)) {
+    e.encodeTag (tSet, CONSTRUCTED);
+    e.pushState (CERStreamEncoder::SET);
+  } else if (pf == static_cast<manipulator>(end)) {
+    e.popState ();
+  } else {
+    e.encodeForward (pf);
+  }
+  return e;
+}
+
+inline CERStreamEncoder &operator<< (CERStreamEncoder &e, tag t) {
+  e.overrideNextTag (t._t, t._c);
+  return e;
+}
+
+END_ASN1_NS
+
+#endif /* ASN1_CERSTREAMENCODER_H_ */
@@ -0,0 +1,409 @@
+/* Emacs, this is -*-C++-*- */
+
+#ifndef ASN1_DERBACKENCODER_H_
+#define ASN1_DERBACKENCODER_H_
+
+#include "base.h"
+#include "Tag.h"
+#include "OID.h"
+#include "buffer.h"
+#include "span.h"
+#include "set_order.h"
+#include "strings.h"
+#include "DEREncoder.h"
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+BEGIN_ASN1_NS
+
+/* A DER encoder that writes from the end of a single buffer towards the
+   front.  By the time a constructed value's identifier and length are
+   written its contents are already in place, so the length is known and
+   nothing is ever copied from one buffer to another (as DEREncoder does
+   once per level of nesting).
+
+   The catch is that values must be given last first.  A << chain is
+   written in mirror image: end opens a constructed value, sequence or set
+   closes it, and a tag follows the value it applies to, so
+
+     DERBackEncoder e;
+
+     e << asn1::end << true << asn1::tag (t) << 5 << asn1::sequence;
+
+   gives the same octets as
+
+     DEREncoder e;
+
+     e << asn1::sequence << 5 << asn1::tag (t) << true << asn1::end; */
+class DERBackEncoder
+{
+public:
+  typedef enum {
+    SEQUENCE = 0,
+    SET = 1
+  } PushMode;
+
+private:
+  allocator          &_alloc;
+  octet              *_b, *_p, *_e;   // Storage, start of data, end
+  std::vector<size_t> _marks;         // Length at each open pushState()
+  DEREncoder::buffer  _scratch;       // For values we have no writer for
+
+  void grow(size_t n) {
+    size_t cap = _e - _b, len = _e - _p;
+    size_t ncap = std::max (cap * 2, cap + ((n + 63) & ~size_t(63)));
+    octet *nb = _alloc.resize (_b, cap, ncap);
+
+    // The data lives at the end, so move it there
+    if (len)
+      std::memmove (nb + ncap - len, nb + cap - len, len);
+    _b = nb;
+    _e = nb + ncap;
+    _p = _e - len;
+  }
+
+  static void store(octet *p, uint64 w) {
+    w = machine::to_be (w);
+    std::memcpy (p, &w, sizeof(w));
+  }
+
+  static unsigned identifierLength(const octet *p) {
+    unsigned n = 1;
+    if ((p[0] & 0x1f) == 0x1f) {
+      while (p[n] & 0x80)
+        ++n;
+      ++n;
+    }
+    return n;
+  }
+
+  // The total length of the element at p, which we wrote, so is well-formed
+  static size_t elementLength(const octet *p) {
+    unsigned n = identifierLength (p);
+    size_t len = p[n++];
+
+    if (len & 0x80) {
+      unsigned count = len & 0x7f;
+      len = 0;
+      while (count--)
+        len = (len << 8) | p[n++];
+    }
+    return n + len;
+  }
+
+  // Put the elements in [p, p + len) into DER SET order (X.690 11.6)
+  void sortSet(octet *p, size_t len);
+
+public:
+  DERBackEncoder(allocator &alloc = dynamic_allocator)
+    : _alloc(alloc), _b(0), _p(0), _e(0), _scratch(alloc) {}
+  ~DERBackEncoder() { _alloc.release (_b, _e - _b); }
+
+  DERBackEncoder(const DERBackEncoder &) = delete;
+  DERBackEncoder &operator=(const DERBackEncoder &) = delete;
+
+  // Make sure there's room to write at least n more octets
+  void reserve(size_t n) {
+    if (static_cast<size_t>(_p - _b) < n)
+      grow (n);
+  }
+
+  const octet *data() const { return _p; }
+  size_t length() const { return _e - _p; }
+
+  // Forget everything written, keeping the storage
+  void clear() {
+    _p = _e;
+    _marks.clear();
+  }
+
+  // Each of these puts its octets in front of everything written so far
+  void encodeOctet(octet o) {
+    reserve (1);
+    *--_p = o;
+  }
+  void encodeOctets(const octet *o, size_t len) {
+    if (!len)
+      return;
+    reserve (len);
+    _p -= len;
+    std::memcpy (_p, o, len);
+  }
+
+  void encodeLength(uint32 len) {
+    reserve (5);
+    if (len <= 0x7f) {
+      *--_p = len;
+      return;
+    }
+
+    octet count = 0;
+    do {
+      *--_p = len & 0xff;
+      len >>= 8;
+      ++count;
+    } while (len);
+    *--_p = 0x80 | count;
+  }
+
+  void encodeIdentifier(Tag t, PrimitiveOrConstructed c = PRIMITIVE) {
+    octet pc = c ? 0x20 : 0;
+
+    reserve (6);
+    if (t.number < 31) {
+      *--_p = (t.tagClass << 6) | pc | t.number;
+      return;
+    }
+
+    uint32 number = t.number;
+    *--_p = number & 0x7f;
+    while (number >>= 7)
+      *--_p = 0x80 | (number & 0x7f);
+    *--_p = (t.tagClass << 6) | pc | 0x1f;
+  }
+
+  void encodeHeader(Tag t, uint32 len, PrimitiveOrConstructed c = PRIMITIVE) {
+    if (t.number < 31 && len <= 0x7f) {
+      reserve (2);
+      _p -= 2;
+      _p[0] = (t.tagClass << 6) | (c ? 0x20 : 0) | t.number;
+      _p[1] = len;
+      return;
+    }
+    encodeLength (len);
+    encodeIdentifier (t, c);
+  }
+
+  // Encode an INTEGER; w and len are as for DEREncoder::encodeInteger()
+  void encodeInteger(uint64 w, unsigned len) {
+    octet id = (UNIVERSAL << 6) | tInteger.number;
+
+    reserve (16);
+    if (len <= 6) {
+      // Identifier, length and contents right-justified in one store
+      uint64 mask = (uint64(1) << (8 * len)) - 1;
+      store (_p - 8, (uint64(id) << (8 * len + 8))
+             | (uint64(len) << (8 * len)) | (w & mask));
+      _p -= 2 + len;
+      return;
+    }
+
+    store (_p - 8, w);
+    _p -= len;
+    if (len > 8)
+      _p[0] = 0;
+    _p -= 2;
+    _p[0] = id;
+    _p[1] = len;
+  }
+
+  /* Give the element written last (the first in the encoding) tag t,
+     as DEREncoder::overrideNextTag() would have done */
+  void retag(Tag t, PrimitiveOrConstructed c) {
+    if (_p == _e)
+      throw std::runtime_error("Nothing to tag in DER encoding");
+    _p += identifierLength (_p);
+    encodeIdentifier (t, c);
+  }
+
+  /* Since we write backwards, pushState() marks the end of a constructed
+     value's contents, and popState() their start, when it writes the
+     identifier and length. */
+  void pushState() {
+    _marks.push_back (length());
+  }
+  void popState(Tag t, PushMode p = SEQUENCE) {
+    if (_marks.empty())
+      throw std::runtime_error("Missing ASN1::end in DER encoding");
+
+    size_t len = length() - _marks.back();
+    _marks.pop_back();
+
+    if (p == SET)
+      sortSet (_p, len);
+    encodeLength (len);
+    encodeIdentifier (t, CONSTRUCTED);
+  }
+  void popState(PushMode p) {
+    popState (p == SET ? tSet : tSequence, p);
+  }
+
+  /* Prepend the DER encoding of v as produced by DEREncoder; used for
+     anything we have no writer of our own for */
+  template <class T>
+  void encodeForward(const T &v) {
+    _scratch.clear();
+    {
+      DEREncoder e (_scratch, _alloc);
+      e << v;
+      e.asDER();
+    }
+    encodeOctets (_scratch.data(), _scratch.length());
+  }
+
+  octet_span asDER() const {
+    if (!_marks.empty())
+      throw std::runtime_error("Missing ASN1::sequence or ASN1::set in "
+                               "DER encoding");
+    return octet_span (_p, _e);
+  }
+};
+
+inline void DERBackEncoder::sortSet(octet *p, size_t len)
+{
+  std::vector<set_item> items;
+  bool sorted = true;
+
+  for (size_t offset = 0; offset < len; ) {
+    set_item item = { offset, elementLength (p + offset) };
+    items.push_back (item);
+    offset += item.length;
+  }
+
+  sort_set_items (p, items.data(), items.data() + items.size());
+
+  for (size_t n = 1; n < items.size(); ++n) {
+    if (items[n].offset < items[n - 1].offset)
+      sorted = false;
+  }
+  if (sorted)
+    return;
+
+  std::vector<octet> copy (p, p + len);
+  for (auto i = items.begin(); i < items.end(); ++i) {
+    std::memcpy (p, copy.data() + i->offset, i->length);
+    p += i->length;
+  }
+}
+
+inline DERBackEncoder &operator<< (DERBackEncoder &e, bool b) {
+  e.encodeOctet (b ? 0xff : 0x00);
+  e.encodeHeader (tBoolean, 1);
+  return e;
+}
+
+inline DERBackEncoder &operator<< (DERBackEncoder &e, int32 i) {
+  e.encodeInteger (uint64(int64(i)), DEREncoder::integerLength (int64(i)));
+  return e;
+}
+
+inline DERBackEncoder &operator<< (DERBackEncoder &e, uint32 i) {
+  e.encodeInteger (i, DEREncoder::integerLength (uint64(i)));
+  return e;
+}
+
+inline DERBackEncoder &operator<< (DERBackEncoder &e, int64 i) {
+  e.encodeInteger (uint64(i), DEREncoder::integerLength (i));
+  return e;
+}
+
+inline DERBackEncoder &operator<< (DERBackEncoder &e, uint64 i) {
+  e.encodeInteger (i, DEREncoder::integerLength (i));
+  return e;
+}
+
+template <class A>
+DERBackEncoder &operator<< (DERBackEncoder &e,
+                            const std::vector<octet, A> &v) {
+  e.encodeOctets (v.data(), v.size());
+  e.encodeHeader (tOctetString, v.size());
+  return e;
+}
+
+// There's nothing to gain from referencing octets here, so they're copied
+inline DERBackEncoder &operator<< (DERBackEncoder &e, const octet_ref &r) {
+  e.encodeOctets (r.data(), r.size());
+  e.encodeHeader (tOctetString, r.size());
+  return e;
+}
+
+inline DERBackEncoder &operator<< (DERBackEncoder &e, const OID &o)
+{
+  size_t start = e.length();
+
+  for (auto i = o.end(); i > o.begin() + 2; ) {
+    uint32 w = *--i;
+    e.encodeOctet (w & 0x7f);
+    while (w >>= 7)
+      e.encodeOctet (0x80 | (w & 0x7f));
+  }
+
+  uint32 w = o[0] * 40 + o[1];
+  e.encodeOctet (w & 0x7f);
+  while (w >>= 7)
+    e.encodeOctet (0x80 | (w & 0x7f));
+
+  e.encodeHeader (tOID, e.length() - start);
+  return e;
+}
+
+inline DERBackEncoder &operator<< (DERBackEncoder &e, const RelativeOID &o)
+{
+  size_t start = e.length();
+
+  for (auto i = o.end(); i > o.begin(); ) {
+    uint32 w = *--i;
+    e.encodeOctet (w & 0x7f);
+    while (w >>= 7)
+      e.encodeOctet (0x80 | (w & 0x7f));
+  }
+
+  e.encodeHeader (tRelativeOID, e.length() - start);
+  return e;
+}
+
+// Octet-per-character string types
+#define ASN1_BACK_STRING(Type, t)                                       \
+  inline DERBackEncoder &operator<< (DERBackEncoder &e, const Type &s) { \
+    e.encodeOctets ((const octet *)s.data(), s.length());               \
+    e.encodeHeader (t, s.length());                                     \
+    return e;                                                           \
+  }
+
+ASN1_BACK_STRING(GeneralString, tGeneralString)
+ASN1_BACK_STRING(GraphicString, tGraphicString)
+ASN1_BACK_STRING(IA5String, tIA5String)
+ASN1_BACK_STRING(NumericString, tNumericString)
+ASN1_BACK_STRING(PrintableString, tPrintableString)
+ASN1_BACK_STRING(T61String, tT61String)
+ASN1_BACK_STRING(UTF8String, tUTF8String)
+ASN1_BACK_STRING(VideotexString, tVideotexString)
+ASN1_BACK_STRING(ISO646String, tISO646String)
+
+#undef ASN1_BACK_STRING
+
+// Everything else (REAL, BIT STRING, choices...) goes via DEREncoder
+template <class T>
+DERBackEncoder &operator<< (DERBackEncoder &e, const T &v) {
+  e.encodeForward (v);
+  return e;
+}
+
+/* The DEREncoder manipulators, mirrored: end opens a constructed value
+   and sequence or set closes it */
+inline DERBackEncoder &operator<< (DERBackEncoder &e,
+                                   DEREncoder &(*pf)(DEREncoder &)) {
+  typedef DEREncoder &(*manipulator)(DEREncoder &);
+
+  if (pf == static_cast<manipulator>(end))
+    e.pushState ();
+  else if (pf == static_cast<manipulator>(sequence))
+    e.popState (DERBackEncoder::SEQUENCE);
+  else if (pf == static_cast<manipulator>(set))
+    e.popState (DERBackEncoder::SET);
+  else
+    e.encodeForward (pf);
+  return e;
+}
+
+// Retag the value before this in the chain; see DERBackEncoder above
+inline DERBackEncoder &operator<< (DERBackEncoder &e, tag t) {
+  e.retag (t._t, t._c);
+  return e;
+}
+
+END_ASN1_NS
+
+#endif /* ASN1_DERBACKENCODER_H_ */
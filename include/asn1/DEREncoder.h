@@ -9,6 +9,8 @@
 #include "OID.h"
 #include "buffer.h"
 #include "strings.h"
+#include "set_order.h"
+#include "span.h"
 
 #include <vector>
 #include <list>
@@ -18,6 +20,7 @@
 #include <algorithm>
 #include <memory>
 #include <functional>
+#include <cstring>
 
 BEGIN_ASN1_NS
 
@@ -28,35 +31,84 @@ public:
 
 private:
 
+  // Octets in caller's memory that belong at offset in a State's buffer
+  struct reference {
+    size_t       offset;
+    const octet *data;
+    size_t       length;
+  };
+
   struct State {
     buffer               *s;
+    buffer               *parent;
+    bool                  owned;
     bool                  in_set;
 
-    std::vector<buffer *> set_items;
-
-    State() : s(0), in_set(false) {}
-    State(State &&other) : s(other.s), in_set(other.in_set),
-                           set_items(std::move(other.set_items))
+    std::vector<size_t>   set_items;  // Where each SET item starts in s
+
+    // Two-pass encoding: where the contents start, and which size is ours
+    size_t                start;
+    size_t                index;
+
+    // Referenced octets, in order; copy_refs if we can't have any here
+    std::vector<reference> refs;
+    size_t                referenced;
+    bool                  copy_refs;
+
+    State() : s(0), parent(0), owned(false), in_set(false),
+              start(0), index(0), referenced(0), copy_refs(false) {}
+    State(State &&other) : s(other.s), parent(other.parent),
+                           owned(other.owned), in_set(other.in_set),
+                           set_items(std::move(other.set_items)),
+                           start(other.start), index(other.index),
+                           refs(std::move(other.refs)),
+                           referenced(other.referenced),
+                           copy_refs(other.copy_refs)
     {}
-    State(const State &other) : s(other.s), in_set(other.in_set),
-                                set_items(other.set_items)
+    State(const State &other) : s(other.s), parent(other.parent),
+                                owned(other.owned), in_set(other.in_set),
+                                set_items(other.set_items),
+                                start(other.start), index(other.index),
+                                refs(other.refs),
+                                referenced(other.referenced),
+                                copy_refs(other.copy_refs)
     {}
 
     State &operator=(const State &other) {
       s = other.s;
+      parent = other.parent;
+      owned = other.owned;
       in_set = other.in_set;
       set_items = other.set_items;
+      start = other.start;
+      index = other.index;
+      refs = other.refs;
+      referenced = other.referenced;
+      copy_refs = other.copy_refs;
       return *this;
     }
 
     State &operator=(State &&other) {
       s = other.s;
+      parent = other.parent;
+      owned = other.owned;
       in_set = other.in_set;
       set_items = std::move(other.set_items);
+      start = other.start;
+      index = other.index;
+      refs = std::move(other.refs);
+      referenced = other.referenced;
+      copy_refs = other.copy_refs;
       return *this;
     }
   };
 
+  typedef enum {
+    NORMAL,     // Each constructed value is built in its own buffer
+    SIZING,     // Two-pass, first pass: count octets, write nothing
+    WRITING     // Two-pass, second pass: write straight to the output
+  } Pass;
+
   bool                   _replace_next_tag;
   Tag                    _next_tag;
   PrimitiveOrConstructed _next_tag_constructed;
@@ -64,36 +116,109 @@ private:
   buffer             *_s;
   State              *_state;
   std::vector<State>  _stack;
-  bool                _release_top;
 
   allocator          &_alloc;
 
-  static bool ptrcmp(buffer *a, buffer *b) { return *a < *b; }
+  Pass                _pass;
+  std::vector<size_t> _sizes;   // Constructed lengths, in pushState() order
+  size_t              _next_size;
+  size_t              _counted; // Octets counted but not held in _scratch
+  size_t              _sized_refs; // Of those, how many will be referenced
+  buffer              _scratch; // Sink for small writes while sizing
+
+  // Storage kept for reuse, so a long-lived encoder stops allocating
+  std::vector<buffer *>                 _free;        // Nesting buffers
+  std::vector<std::vector<size_t> >     _spare_items; // SET item offsets
+  std::vector<std::vector<reference> >  _spare_refs;  // Referenced octets
+  std::vector<set_item>                 _order;
+  set_sorter                            _sorter;
+
+  // Octets encoded so far in the sizing pass
+  size_t sized() const { return _counted + _scratch.length(); }
+
+  buffer *newBuffer() {
+    if (_free.empty())
+      return new buffer(_alloc);
+
+    buffer *b = _free.back();
+    _free.pop_back();
+    b->clear();
+    return b;
+  }
+  void freeBuffer(buffer *b) {
+    _free.push_back(b);
+  }
+
+  // Drop any unfinished constructed values and return to normal mode
+  void unwind() {
+    while (_stack.size() > 1) {
+      State &st = _stack.back();
+      if (st.owned)
+        freeBuffer(st.s);
+      _stack.pop_back();
+    }
+    _state = &_stack.back();
+    _s = _state->s;
+    _pass = NORMAL;
+    _replace_next_tag = false;
+  }
 
 public:
   DEREncoder(allocator &alloc = dynamic_allocator)
-    : _replace_next_tag(false), _stack(1, State()), 
-      _release_top(true), _alloc(alloc) {
+    : _replace_next_tag(false), _stack(1, State()), _alloc(alloc),
+      _pass(NORMAL), _next_size(0), _counted(0), _sized_refs(0),
+      _scratch(alloc) {
     _state = &_stack.back();
     _s = _state->s = new buffer(_alloc);
+    _state->owned = true;
   }
   DEREncoder(buffer &b,
              allocator &alloc = dynamic_allocator)
-    : _replace_next_tag(false), _stack(1, State()),
-      _release_top(false), _alloc(alloc)
+    : _replace_next_tag(false), _stack(1, State()), _alloc(alloc),
+      _pass(NORMAL), _next_size(0), _counted(0), _sized_refs(0),
+      _scratch(alloc)
   {
     _state = &_stack.back();
     _s = _state->s = &b;
   }
   ~DEREncoder() {
-    std::vector<State>::iterator i;
-    for (i = _stack.begin(); i < _stack.end(); ++i) {
-      State &st = *i;
-      if (_release_top || i != _stack.end() - 1)
-        delete st.s;
-      for (auto j = st.set_items.begin(); j < st.set_items.end(); ++j)
-        delete *j;
-    }
+    unwind();
+    if (_state->owned)
+      delete _state->s;
+    for (auto i = _free.begin(); i < _free.end(); ++i)
+      delete *i;
+  }
+
+  /* Discard everything encoded so far, ready for the next message.  The
+     storage is all kept, both the output buffer's and that of the buffers
+     used for nested values, so an encoder reused this way soon stops
+     allocating altogether. */
+  void reset() {
+    unwind();
+    _s->clear();
+    _state->refs.clear();
+    _state->referenced = 0;
+  }
+
+  /* Exchange the encoding for the contents of b without copying it; the
+     encoder carries on, empty, with b's old storage.  Swapping the same
+     buffer back and forth between messages allocates nothing.  b must
+     use the same allocator as the encoder's output buffer. */
+  void swap(buffer &b) {
+    if (_stack.size() != 1)
+      throw std::runtime_error("Missing ASN1::end in DER encoding");
+    if (_state->referenced)
+      throw std::runtime_error("DER encoding has referenced octets; "
+                               "use gather()");
+    _s->swap(b);
+    _s->clear();
+  }
+
+  // Take the encoding, leaving the encoder empty (and without storage)
+  buffer take() {
+    buffer b(_alloc);
+    swap(b);
+    return b;
   }
 
   void overrideNextTag(const Tag t, PrimitiveOrConstructed c)
@@ -105,9 +230,18 @@ public:
     }
   }
 
+  // Make sure there's room for at least n more octets in the current value
+  void reserve(size_t n) {
+    if (_pass != SIZING)
+      _s->reserve(n);
+  }
+
   void encodeOctet(octet o) { _s->put_octet(o); }
   void encodeOctets(const octet *o, unsigned len) {
-    _s->put_octets(o, len);
+    if (_pass == SIZING)
+      _counted += len;
+    else
+      _s->put_octets(o, len);
   }
   void encode(uint16 w) {
     _s->put_uint16(w);
@@ -143,11 +277,26 @@ public:
     encodeOctet(w & 0x7f);
   }
 
-  void encodeTag(Tag t, PrimitiveOrConstructed c = PRIMITIVE)
+private:
+  // Write eight (or two) octets big-endian, without any alignment requirement
+  static void store(octet *p, uint64 w) {
+    w = machine::to_be (w);
+    std::memcpy (p, &w, sizeof(w));
+  }
+  static void store(octet *p, uint16 w) {
+    w = machine::to_be (w);
+    std::memcpy (p, &w, sizeof(w));
+  }
+
+  // Start a new element, applying any tag override
+  void beginElement(Tag &t, PrimitiveOrConstructed &c)
   {
-    if (_state->in_set) {
-      _state->set_items.push_back(new buffer(_alloc));
-      _s = _state->set_items.back();
+    if (_pass == SIZING) {
+      // Nothing reads what we write while sizing, so keep the sink small
+      _counted += _scratch.length();
+      _scratch.clear();
+    } else if (_state->in_set) {
+      _state->set_items.push_back(_state->s->length());
     }
 
     if (_replace_next_tag) {
@@ -155,7 +304,10 @@ public:
       c = _next_tag_constructed;
       _replace_next_tag = false;
     }
+  }
 
+  void encodeIdentifier(Tag t, PrimitiveOrConstructed c)
+  {
     octet pc = c ? 0x20 : 0;
 
     if (t.number < 31)
@@ -168,7 +320,97 @@ public:
     }
   }
 
+public:
+  void encodeTag(Tag t, PrimitiveOrConstructed c = PRIMITIVE)
+  {
+    beginElement (t, c);
+    encodeIdentifier (t, c);
+  }
+
+  /* encodeTag() followed by encodeLength().  Almost every element has a
+     one-octet identifier and a short-form length, which we write with a
+     single 16-bit store. */
+  void encodeHeader(Tag t, uint32 len, PrimitiveOrConstructed c = PRIMITIVE)
+  {
+    beginElement (t, c);
+
+    if (t.number < 31 && len <= 0x7f) {
+      octet id = (t.tagClass << 6) | (c ? 0x20 : 0) | t.number;
+      reserve (2 + len);
+      store (_s->prepare (2), (uint16)(id << 8 | len));
+      _s->commit (2);
+      return;
+    }
+
+    encodeIdentifier (t, c);
+    encodeLength (len);
+  }
+
+  /* The number of contents octets in the DER encoding of an INTEGER.
+     That's one more than the number of bits that differ from the sign
+     bit, rounded up to whole octets; since clz(0) is 64, zero needs one
+     octet, like everything else that fits in seven bits. */
+  static unsigned integerLength(int64 i) {
+    return unsigned(72 - machine::clz (uint64(i ^ (i >> 63)))) >> 3;
+  }
+  static unsigned integerLength(uint64 u) {
+    return unsigned(72 - machine::clz (u)) >> 3;
+  }
+
+  /* Encode an INTEGER whose value, in two's complement, is w; len is from
+     integerLength(), and 9 means a leading zero then all of w.  With a
+     one-octet identifier (the usual case, and always so unless the tag
+     is overridden) the identifier, length and up to six contents octets
+     are assembled in a register and written with a single store; longer
+     values take one more. */
+  void encodeInteger(uint64 w, unsigned len)
+  {
+    Tag t = tInteger;
+    PrimitiveOrConstructed c = PRIMITIVE;
+
+    beginElement (t, c);
+
+    if (t.number >= 31) {
+      uint64 wbe = machine::to_be (w);
+
+      encodeIdentifier (t, c);
+      encodeLength (len);
+      if (len > 8) {
+        encodeOctet (0);
+        --len;
+      }
+      encodeOctets ((const octet *)&wbe + 8 - len, len);
+      return;
+    }
+
+    uint64 id = (t.tagClass << 6) | (c ? 0x20 : 0) | t.number;
+    octet *p = _s->prepare (16);
+
+    if (len <= 6) {
+      uint64 tlv = (id << 56) | (uint64(len) << 48)
+        | ((w << (64 - 8 * len)) >> 16);
+      store (p, tlv);
+    } else {
+      // Always write eight octets of contents; we only commit len of them
+      store (p, (id << 56) | (uint64(len) << 48));
+      if (len > 8)
+        store (p + 3, w);
+      else
+        store (p + 2, w << (64 - 8 * len));
+    }
+
+    _s->commit (2 + len);
+  }
+
   void encodeLength(uint32 len)
+  {
+    writeLength (len);
+    reserve (len);
+  }
+
+private:
+  // encodeLength() without making room for the contents
+  void writeLength(uint32 len)
   {
     if (len <= 0x7f) {
       encodeOctet (len);
@@ -189,44 +431,324 @@ public:
         encodeOctet (len);
       }
     }
+  }
 
-    _s->reserve (len);
+  // Constructed lengths are added up in size_t, but DER lengths are 32 bits
+  static uint32 checkLength(size_t len)
+  {
+    if (len > 0xffffffff)
+      throw std::runtime_error("DER encoding too long");
+    return (uint32)len;
+  }
+
+public:
+
+  // The number of octets encodeLength() writes
+  static unsigned lengthLength(uint32 len) {
+    if (len <= 0x7f)
+      return 1;
+    if (len > 0xffffff)
+      return 5;
+    if (len > 0xffff)
+      return 4;
+    if (len > 0xff)
+      return 3;
+    return 2;
+  }
+
+  /* Referencing a short run of octets costs more than copying it, so
+     encodeReference() copies anything shorter than this */
+  static const size_t reference_threshold = 256;
+
+  /* Encode a primitive element whose contents, at o, are referenced rather
+     than copied into the encoding; gather() then yields them in place.
+     The caller's octets must stay put until the encoding has been written
+     out.  Inside a SET (whose items DER sorts) they are copied. */
+  void encodeReference(Tag t, const octet *o, size_t len)
+  {
+    PrimitiveOrConstructed c = PRIMITIVE;
+
+    if (len > 0xffffffff)
+      throw std::runtime_error("DER encoding too long");
+
+    beginElement (t, c);
+    encodeIdentifier (t, c);
+    writeLength (len);
+    referenceOctets (o, len);
+  }
+
+  /* Encode a constructed element whose contents are runs [first, last)
+     one after another, each referenced as by encodeReference().  This
+     stitches together parts encoded separately (see parallel.h) without
+     copying them. */
+  void encodeReferences(Tag t, const octet_span *first, const octet_span *last)
+  {
+    PrimitiveOrConstructed c = CONSTRUCTED;
+    uint64 len = 0;
+
+    for (const octet_span *r = first; r < last; ++r)
+      len += r->size();
+    if (len > 0xffffffff)
+      throw std::runtime_error("DER encoding too long");
+
+    beginElement (t, c);
+    encodeIdentifier (t, c);
+    writeLength ((uint32)len);
+    for (const octet_span *r = first; r < last; ++r)
+      referenceOctets (r->data(), r->size());
+  }
+
+private:
+  void referenceOctets(const octet *o, size_t len)
+  {
+    bool copy = _state->copy_refs || len < reference_threshold;
+
+    if (_pass == SIZING) {
+      _counted += len;
+      if (!copy)
+        _sized_refs += len;
+    } else if (copy) {
+      encodeOctets (o, len);
+    } else {
+      reference r = { _s->length(), o, len };
+      _state->refs.push_back (r);
+      _state->referenced += len;
+    }
   }
 
+public:
+
   typedef enum {
     SEQUENCE = 0,
     SET = 1
   } PushMode;
 
   void pushState(PushMode p) {
-    _stack.push_back(DEREncoder::State());
+    State st;
+
+    st.parent = _s;
+    st.in_set = p == SET;
+    if (st.in_set && !_spare_items.empty()) {
+      st.set_items = std::move(_spare_items.back());
+      _spare_items.pop_back();
+    }
+    st.copy_refs = _state->copy_refs || st.in_set;
+    if (!st.copy_refs && !_spare_refs.empty()) {
+      st.refs = std::move(_spare_refs.back());
+      _spare_refs.pop_back();
+    }
+
+    switch (_pass) {
+    case NORMAL:
+      st.s = newBuffer();
+      st.owned = true;
+      break;
+    case SIZING:
+      st.s = _s;
+      st.start = sized();
+      st.index = _sizes.size();
+      _sizes.push_back(0);
+      break;
+    case WRITING:
+      if (_next_size >= _sizes.size())
+        throw std::runtime_error("Two-pass DER encoding passes differ");
+      st.index = _next_size++;
+      // encodeTwoPass() has already made room for everything we copy
+      writeLength (checkLength (_sizes[st.index]));
+      st.s = _s;
+      st.start = _s->length();
+      break;
+    }
+
+    _stack.push_back(std::move(st));
     _state = &_stack.back();
-    _s = _state->s = new buffer(_alloc);
-    _state->in_set = p == SET;
+    _s = _state->s;
   }
   void popState() {
     State &s = *_state;
-    if (s.in_set) {
-      std::sort(s.set_items.begin(), s.set_items.end(), ptrcmp);
-      for (auto i = s.set_items.begin(); i < s.set_items.end(); ++i) {
-        s.s->put_buffer(**i);
-        delete *i;
+    std::vector<set_item> &order = _order;
+
+    order.clear();
+    if (s.in_set && _pass != SIZING)
+      orderSet (s, order);
+
+    _state = &_stack[_stack.size() - 2];
+    _s = s.parent;
+    switch (_pass) {
+    case NORMAL:
+      // Make room only for what we copy; referenced octets stay put
+      writeLength (checkLength (s.s->length() + s.referenced));
+      reserve (s.s->length());
+      if (s.in_set) {
+        for (auto i = order.begin(); i < order.end(); ++i)
+          encodeOctets (s.s->data() + i->offset, i->length);
+      } else {
+        // Our references move with our contents
+        for (auto i = s.refs.begin(); i < s.refs.end(); ++i)
+          i->offset += _s->length();
+        encodeOctets (s.s->data(), s.s->length());
       }
+      freeBuffer (s.s);
+      break;
+    case SIZING:
+      _sizes[s.index] = sized() - s.start;
+      _counted += lengthLength (checkLength (_sizes[s.index]));
+      break;
+    case WRITING:
+      if (s.s->length() - s.start + s.referenced != _sizes[s.index])
+        throw std::runtime_error("Two-pass DER encoding passes differ");
+      if (s.in_set && !inOrder (order)) {
+        // The items are already in the output; put them in order there
+        octet *base = s.s->data();
+        octet *p = base + s.start;
+
+        _scratch.clear();
+        _scratch.put_octets (p, s.s->length() - s.start);
+        for (auto i = order.begin(); i < order.end(); ++i) {
+          std::memcpy (p, _scratch.data() + (i->offset - s.start), i->length);
+          p += i->length;
+        }
+      }
+      break;
+    }
+    _state->refs.insert (_state->refs.end(), s.refs.begin(), s.refs.end());
+    _state->referenced += s.referenced;
+    if (s.in_set) {
+      s.set_items.clear();
+      _spare_items.push_back(std::move(s.set_items));
+    }
+    if (!s.copy_refs) {
+      s.refs.clear();
+      _spare_refs.push_back(std::move(s.refs));
     }
-    _state = &_stack[_stack.size() - 2];
-    _s = _state->s;
-    encodeLength (s.s->length());
-    encodeOctets (s.s->data(), s.s->length());
-    delete s.s;
     _stack.pop_back();
   }
 
+  /* Work out the order of the items in a SET, which were written one after
+     another into s.s.  Anything written before the first item (e.g. an
+     EXPLICIT tag written by hand) stays at the front. */
+  void orderSet(const State &s, std::vector<set_item> &order) {
+    size_t count = s.set_items.size();
+    size_t end = s.s->length();
+    size_t first = count ? s.set_items.front() : end;
+
+    if (first > s.start)
+      order.push_back({ s.start, first - s.start });
+
+    for (size_t n = 0; n < count; ++n) {
+      size_t next = n + 1 < count ? s.set_items[n + 1] : end;
+      order.push_back({ s.set_items[n], next - s.set_items[n] });
+    }
+
+    set_item *items = order.data() + (first > s.start);
+    _sorter.sort (s.s->data(), items, order.data() + order.size());
+  }
+
+  static bool inOrder(const std::vector<set_item> &order) {
+    for (size_t n = 1; n < order.size(); ++n) {
+      if (order[n].offset < order[n - 1].offset)
+        return false;
+    }
+    return true;
+  }
+
 public:
   const buffer &asDER() const {
     if (_stack.size() != 1)
       throw std::runtime_error("Missing ASN1::end in DER encoding");
+    if (_state->referenced)
+      throw std::runtime_error("DER encoding has referenced octets; "
+                               "use gather()");
     return *_s;
   }
+
+  /* Append the encoding to out as a list of runs of octets, alternating
+     between our own buffer and any octets given to encodeReference(), so
+     that they can be written out without first being copied together.
+     Vec's value_type must be constructible as { octet *, size_t }, which
+     holds for octet_span and for POSIX's struct iovec, e.g.
+
+       std::vector<struct iovec> iov;
+
+       e.gather (iov);
+       writev (fd, iov.data(), iov.size()); */
+  template <class Vec>
+  void gather(Vec &out) const {
+    typedef typename Vec::value_type run;
+
+    if (_stack.size() != 1)
+      throw std::runtime_error("Missing ASN1::end in DER encoding");
+
+    octet *p = const_cast<octet *>(_s->data());
+    size_t pos = 0;
+
+    for (auto i = _state->refs.begin(); i < _state->refs.end(); ++i) {
+      if (i->offset > pos)
+        out.push_back (run { p + pos, i->offset - pos });
+      out.push_back (run { const_cast<octet *>(i->data), i->length });
+      pos = i->offset;
+    }
+    if (_s->length() > pos)
+      out.push_back (run { p + pos, _s->length() - pos });
+  }
+
+  // The length of the whole encoding, including any referenced octets
+  size_t encodedLength() const {
+    return _s->length() + _state->referenced;
+  }
+
+  /* Encode in two passes.  f(*this) is called twice and must encode the
+     same values both times.  The first pass only measures: it records
+     the length of every constructed value and writes nothing.  The
+     second writes each length as its value starts, so everything goes
+     straight into the output, sized up front, rather than being built
+     in a buffer per SEQUENCE and copied into its parent; deep nesting no
+     longer copies the leaves once per level.  That only pays off for deep
+     structures with sizeable leaves: a 32-level chain over a 4 KB value
+     encodes about ten times faster, but something the shape of an X.509
+     certificate is no faster (a little slower, since f runs twice); see
+     samples/encodebench.cc.  Items in a SET are still buffered, since DER
+     wants them sorted.  If f throws, or the passes don't match, the output
+     is left as it was. */
+  template <class F>
+  void encodeTwoPass(F f) {
+    if (_stack.size() != 1 || _pass != NORMAL)
+      throw std::runtime_error("Two-pass DER encoding must start at the top level");
+
+    buffer *out = _s;
+    size_t mark = out->length();
+    size_t refs = _state->refs.size(), referenced = _state->referenced;
+
+    try {
+      _pass = SIZING;
+      _sizes.clear();
+      _counted = 0;
+      _sized_refs = 0;
+      _scratch.clear();
+      _s = &_scratch;
+      f(*this);
+      if (_stack.size() != 1)
+        throw std::runtime_error("Missing ASN1::end in DER encoding");
+
+      size_t total = sized();
+      _scratch.clear();
+      _s = out;
+      _s->reserve(total - _sized_refs);
+      _pass = WRITING;
+      _next_size = 0;
+      f(*this);
+      if (_stack.size() != 1 || _next_size != _sizes.size())
+        throw std::runtime_error("Two-pass DER encoding passes differ");
+    } catch (...) {
+      unwind();
+      out->truncate(mark);
+      _state->refs.resize(refs);
+      _state->referenced = referenced;
+      throw;
+    }
+
+    _pass = NORMAL;
+  }
 };
 
 inline DEREncoder &operator<< (DEREncoder &e, DEREncoder &(*pf)(DEREncoder &)) {
@@ -234,93 +756,28 @@ inline DEREncoder &operator<< (DEREncoder &e, DEREncoder &(*pf)(DEREncoder &)) {
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, bool b) {
-  e.encodeTag (tBoolean);
-  e.encodeLength (1);
+  e.encodeHeader (tBoolean, 1);
   e.encodeOctet (b ? 0xff : 0x00);
   return e;
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, int32 i) {
-  e.encodeTag (tInteger);
-
-  unsigned lz, extra_zero;
-
-  if (i > 0) {
-    lz = machine::clz (i);
-    extra_zero = !(lz & 7);
-  } else {
-    lz = machine::clz (~i) - 1;
-    extra_zero = 0;
-  }
-
-  uint32 ibe = machine::to_be (i);
-  unsigned offset = lz >> 3;
-  unsigned bytes = 4 - offset;
- 
-  e.encodeLength (bytes + extra_zero);
-  if (extra_zero)
-    e.encodeOctet (0);
-  e.encodeOctets ((octet *)&ibe + offset, bytes);
-
+  e.encodeInteger (uint64(int64(i)), DEREncoder::integerLength (int64(i)));
   return e;
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, uint32 i) {
-  e.encodeTag (tInteger);
-
-  uint32 ibe = machine::to_be (i);
-  unsigned lz = machine::clz (i);
-  unsigned extra_zero = !(lz & 7);
-  unsigned offset = lz >> 3;
-  unsigned bytes = 4 - offset;
- 
-  e.encodeLength (bytes + extra_zero);
-  if (extra_zero)
-    e.encodeOctet (0);
-  e.encodeOctets ((octet *)&ibe + offset, bytes);
-
+  e.encodeInteger (i, DEREncoder::integerLength (uint64(i)));
   return e;
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, int64 i) {
-  e.encodeTag (tInteger);
-
-  unsigned lz, extra_zero;
-
-  if (i > 0) {
-    lz = machine::clz (i);
-    extra_zero = !(lz & 7);
-  } else {
-    lz = machine::clz (~i) - 1;
-    extra_zero = 0;
-  }
-
-  uint64 ibe = machine::to_be (i);
-  unsigned offset = lz >> 3;
-  unsigned bytes = 8 - offset;
- 
-  e.encodeLength (bytes + extra_zero);
-  if (extra_zero)
-    e.encodeOctet (0);
-  e.encodeOctets ((octet *)&ibe + offset, bytes);
-
+  e.encodeInteger (uint64(i), DEREncoder::integerLength (i));
   return e;
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, uint64 i) {
-  e.encodeTag (tInteger);
-
-  uint64 ibe = machine::to_be (i);
-  unsigned lz = machine::clz (i);
-  unsigned extra_zero = !(lz & 7);
-  unsigned offset = lz >> 3;
-  unsigned bytes = 8 - offset;
- 
-  e.encodeLength (bytes + extra_zero);
-  if (extra_zero)
-    e.encodeOctet (0);
-  e.encodeOctets ((octet *)&ibe + offset, bytes);
-
+  e.encodeInteger (i, DEREncoder::integerLength (i));
   return e;
 }
 
@@ -332,36 +789,34 @@ inline DEREncoder &operator<< (DEREncoder &e, double d)
   } un;
   octet o;
 
-  e.encodeTag (tReal);
-
   un.d = d;
   uint64 u = un.u;
 
   /* 8.5.2 If the real value is the value plus zero, there shall be no
      contents octets in the encoding */
   if (u == 0) {
-    e.encodeLength (0);
+    e.encodeHeader (tReal, 0);
     return e;
   }
   
   /* 8.5.3 If the real value is the value minus zero, then it shall be
      encoded as specified in 8.5.9 */
   if (u == 0x8000000000000000) {
-    e.encodeLength (1);
+    e.encodeHeader (tReal, 1);
     e.encodeOctet (0x43);
     return e;
   }
 
   /* 8.5.9 PLUS-INFINITY */
   if (u == 0x7ff0000000000000) {
-    e.encodeLength (1);
+    e.encodeHeader (tReal, 1);
     e.encodeOctet (0x40);
     return e;
   }
   
   /* 8.5.9 MINUS-INFINITY */
   if (u == 0xfff0000000000000) {
-    e.encodeLength (1);
+    e.encodeHeader (tReal, 1);
     e.encodeOctet (0x41);
     return e;
   }
@@ -371,8 +826,9 @@ inline DEREncoder &operator<< (DEREncoder &e, double d)
  
   /* 8.5.9 NOT-A-NUMBER */
   if (exponent == 0x7ff) {
-    e.encodeLength (1);
+    e.encodeHeader (tReal, 1);
     e.encodeOctet (0x42);
+    return e;
   }
 
   if (!exponent) {
@@ -419,7 +875,7 @@ inline DEREncoder &operator<< (DEREncoder &e, double d)
   unsigned mlen = 8 - mofs;
 
   // Actually encode stuff
-  e.encodeLength (elen + mlen + 1);
+  e.encodeHeader (tReal, elen + mlen + 1);
   e.encodeOctet (o);
   
   if (elen == 1)
@@ -436,27 +892,49 @@ inline DEREncoder &operator<< (DEREncoder &e, double d)
 
 template <class A>
 DEREncoder &operator<< (DEREncoder &e, const std::vector<octet, A> &v) {
-  e.encodeTag (tOctetString);
-  e.encodeLength (v.size());
+  e.encodeHeader (tOctetString, v.size());
   e.encodeOctets (v.data(), v.size());
   return e;
 }
 
+/* An OCTET STRING whose contents the encoder refers to instead of copying,
+   for large payloads that are going to be written out with gather(), e.g.
+
+     e << asn1::sequence << id << asn1::octet_ref (data, size) << asn1::end;
+
+   The octets must outlive the encoder's use of them. */
+class octet_ref
+{
+private:
+  const octet *_data;
+  size_t       _size;
+
+public:
+  octet_ref(const octet *data, size_t size) : _data(data), _size(size) {}
+  explicit octet_ref(octet_span s) : _data(s.data()), _size(s.size()) {}
+
+  const octet *data() const { return _data; }
+  size_t size() const { return _size; }
+};
+
+inline DEREncoder &operator<< (DEREncoder &e, const octet_ref &r) {
+  e.encodeReference (tOctetString, r.data(), r.size());
+  return e;
+}
+
 template <class A>
 DEREncoder &operator<< (DEREncoder &e, const BitString<A> &v) {
   unsigned bytes = (v.size() + 7) >> 3;
-  unsigned ignored = 8 - (v.size() & 7);
+  unsigned ignored = (8 - (v.size() & 7)) & 7;
 
-  e.encodeTag (tBitString);
-  e.encodeLength (bytes + 1);
+  e.encodeHeader (tBitString, bytes + 1);
   e.encodeOctet (ignored);
   e.encodeOctets (v.data(), bytes);
   return e;
 }
 
 inline DEREncoder &null(DEREncoder &e) {
-  e.encodeTag (tNull);
-  e.encodeLength (0);
+  e.encodeHeader (tNull, 0);
   return e;
 }
 
@@ -589,18 +1067,16 @@ DEREncoder &operator<< (DEREncoder &e,
   return e;
 }
 
-DEREncoder &operator<< (DEREncoder &e,
-                        const OID &o)
+inline DEREncoder &operator<< (DEREncoder &e,
+                               const OID &o)
 {
-  e.encodeTag (tOID);
-
   unsigned subid = o[0] * 40 + o[1];
   unsigned len = e.lenTBF (subid);
 
   for (auto i = o.begin() + 2; i < o.end(); ++i)
     len += e.lenTBF (*i);
 
-  e.encodeLength (len);
+  e.encodeHeader (tOID, len);
 
   e.encodeTBF (subid);
   for (auto i = o.begin() + 2; i < o.end(); ++i)
@@ -609,16 +1085,14 @@ DEREncoder &operator<< (DEREncoder &e,
   return e;
 }
 
-DEREncoder &operator<< (DEREncoder &e,
-                        const RelativeOID &o)
+inline DEREncoder &operator<< (DEREncoder &e,
+                               const RelativeOID &o)
 {
-  e.encodeTag (tRelativeOID);
-
   unsigned len = 0;
   for (auto i = o.begin(); i < o.end(); ++i)
     len += e.lenTBF (*i);
 
-  e.encodeLength (len);
+  e.encodeHeader (tRelativeOID, len);
 
   for (auto i = o.begin(); i < o.end(); ++i)
     e.encodeTBF (*i);
@@ -628,80 +1102,69 @@ DEREncoder &operator<< (DEREncoder &e,
 
 // String types
 inline DEREncoder &operator<< (DEREncoder &e, const BMPString &bmp) {
-  e.encodeTag (tBMPString);
-  e.encodeLength(bmp.length() * 2);
+  e.encodeHeader (tBMPString, bmp.length() * 2);
   for (auto p = bmp.begin(); p != bmp.end(); ++p)
     e.encode((uint16)*p);
   return e;
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, const UniversalString &us) {
-  e.encodeTag (tUniversalString);
-  e.encodeLength(us.length() * 4);
+  e.encodeHeader (tUniversalString, us.length() * 4);
   for (auto p = us.begin(); p != us.end(); ++p)
     e.encode((uint32)*p);
   return e;
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, const GeneralString &gs) {
-  e.encodeTag (tGeneralString);
-  e.encodeLength (gs.length());
+  e.encodeHeader (tGeneralString, gs.length());
   e.encodeOctets ((const octet *)gs.data(), gs.length());
   return e;
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, const GraphicString &gs) {
-  e.encodeTag (tGraphicString);
-  e.encodeLength (gs.length());
+  e.encodeHeader (tGraphicString, gs.length());
   e.encodeOctets ((const octet *)gs.data(), gs.length());
   return e;
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, const IA5String &ia5) {
-  e.encodeTag (tIA5String);
-  e.encodeLength (ia5.length());
+  e.encodeHeader (tIA5String, ia5.length());
   e.encodeOctets ((const octet *)ia5.data(), ia5.length());
   return e;
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, const NumericString &ns) {
-  e.encodeTag (tNumericString);
-  e.encodeLength (ns.length());
+  e.encodeHeader (tNumericString, ns.length());
   e.encodeOctets ((const octet *)ns.data(), ns.length());
   return e;
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, const PrintableString &ps) {
-  e.encodeTag (tPrintableString);
-  e.encodeLength (ps.length());
+  e.encodeHeader (tPrintableString, ps.length());
   e.encodeOctets ((const octet *)ps.data(), ps.length());
   return e;
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, const T61String &t61s) {
-  e.encodeTag (tT61String);
-  e.encodeLength (t61s.length());
+  e.encodeHeader (tT61String, t61s.length());
   e.encodeOctets ((const octet *)t61s.data(), t61s.length());
   return e;
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, const UTF8String &us) {
-  e.encodeTag (tUTF8String);
-  e.encodeLength (us.length());
+  e.encodeHeader (tUTF8String, us.length());
   e.encodeOctets ((const octet *)us.data(), us.length());
   return e;
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, const VideotexString &vs) {
-  e.encodeTag (tVideotexString);
-  e.encodeLength (vs.length());
+  e.encodeHeader (tVideotexString, vs.length());
   e.encodeOctets ((const octet *)vs.data(), vs.length());
   return e;
 }
 
 inline DEREncoder &operator<< (DEREncoder &e, const ISO646String &is) {
-  e.encodeTag (tISO646String);
-  e.encodeLength (is.length());
+  e.encodeHeader (tISO646String, is.length());
   e.encodeOctets ((const octet *)is.data(), is.length());
   return e;
 }
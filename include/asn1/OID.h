@@ -4,26 +4,48 @@
 #define ASN1_OID_H_
 
 #include "base.h"
+#include <vector>
+#include <ostream>
 
 BEGIN_ASN1_NS
 
 class RelativeOID : public std::vector<uint32>
 {
 public:
+  RelativeOID() {}
   RelativeOID(const RelativeOID &o) : std::vector<uint32>(o) {}
   RelativeOID(RelativeOID &&o) : std::vector<uint32>(o) {}
   RelativeOID(std::initializer_list<uint32> il) : std::vector<uint32>(il) { }
+
+  RelativeOID &operator=(const RelativeOID &o) {
+    std::vector<uint32>::operator= (o);
+    return *this;
+  }
+  RelativeOID &operator=(RelativeOID &&o) {
+    std::vector<uint32>::operator= (std::move (o));
+    return *this;
+  }
 };
 
 class OID : public std::vector<uint32>
 {
 public:
+  OID() {}
   OID(const OID &o) : std::vector<uint32>(o) {}
   OID(OID &&o) : std::vector<uint32>(o) {}
   OID(const OID &o, const RelativeOID &ro) : std::vector<uint32>(o) {
     insert (end(), ro.begin(), ro.end());
   }
   OID(std::initializer_list<uint32> il) : std::vector<uint32>(il) { }
+
+  OID &operator=(const OID &o) {
+    std::vector<uint32>::operator= (o);
+    return *this;
+  }
+  OID &operator=(OID &&o) {
+    std::vector<uint32>::operator= (std::move (o));
+    return *this;
+  }
 };
 
 inline std::ostream &operator<<(std::ostream &os, const OID &o) {
@@ -102,6 +102,10 @@ constexpr Tag tRelativeOIDIRI = { UNIVERSAL, 36 };  // 8.6 / 35
 // UNIVERSAL tags defined by X.690
 constexpr Tag tEndOfContents = { UNIVERSAL, 0 };    // 8.1.5
 
+// Shorthand for other tags, e.g. d.find ({ tSequence, ctx(3) })
+constexpr Tag ctx(uint32 number) { return Tag(CONTEXT_SPECIFIC, number); }
+constexpr Tag app(uint32 number) { return Tag(APPLICATION, number); }
+
 END_ASN1_NS
 
 #endif /* ASN1_TAGS_H_ */
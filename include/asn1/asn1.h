@@ -8,7 +8,15 @@
 #include "traits.h"
 #include "choice.h"
 #include "strings.h"
+#include "span.h"
+#include "string_view.h"
+#include "segments.h"
+#include "ber_view.h"
+#include "mapped_file.h"
 #include "DEREncoder.h"
+#include "DERBackEncoder.h"
+#include "sink.h"
+#include "CERStreamEncoder.h"
 #include "Tag.h"
 
 #endif
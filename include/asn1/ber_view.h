@@ -0,0 +1,208 @@
+/* Emacs, this is -*-C++-*- */
+
+#ifndef ASN1_BER_VIEW_H_
+#define ASN1_BER_VIEW_H_
+
+#include "base.h"
+#include "Tag.h"
+#include "span.h"
+
+#include <stdexcept>
+
+BEGIN_ASN1_NS
+
+/* A non-owning, non-allocating view of a single BER TLV inside a buffer.
+   Unlike BERDecoder, which extracts values sequentially and copies them
+   out, a ber_view just walks the tag and length octets so that you can
+   navigate to the parts of a PDU you're interested in, e.g.
+
+     asn1::ber_view v(data, len);
+
+     for (asn1::ber_view c = v.first_child(); c; c = c.next_sibling()) {
+       if (c.tag() == asn1::tOctetString) {
+         asn1::octet_span s = c.value();
+         ...
+       }
+     }
+
+   Headers are validated as they are visited, so walking a malformed
+   encoding throws std::runtime_error, just as BERDecoder does.  Stepping
+   past the last element of a constructed value (or past the end of the
+   buffer) yields an invalid view, which tests false. */
+class ber_view
+{
+private:
+  const octet *_ptr;           // Identifier octets
+  const octet *_limit;         // End of the enclosing contents
+  const octet *_value;         // First contents octet
+  size_t       _length;        // Contents length (definite form only)
+  Tag          _tag;
+  bool         _constructed;
+  bool         _indefinite;
+  bool         _in_indefinite; // The enclosing value is indefinite length
+
+  ber_view(const octet *ptr, const octet *limit, bool in_indefinite)
+    : _ptr(ptr), _limit(limit), _value(nullptr), _length(0),
+      _constructed(false), _indefinite(false), _in_indefinite(in_indefinite) {
+    parse();
+  }
+
+  static octet get(const octet *&p, const octet *limit) {
+    if (p >= limit)
+      throw std::runtime_error("out of bounds");
+    return *p++;
+  }
+
+  void parse() {
+    const octet *p = _ptr;
+
+    if (p >= _limit) {
+      _ptr = nullptr;
+      return;
+    }
+
+    // Inside an indefinite length value, End of Contents ends the list
+    if (_in_indefinite && !*p) {
+      if (_limit - p < 2 || p[1])
+        throw std::runtime_error("bad length on End of Contents tag");
+      _ptr = nullptr;
+      return;
+    }
+
+    octet t = get(p, _limit);
+    TagClass tc = (TagClass)(t >> 6);
+
+    _constructed = t & 0x20;
+
+    if ((t & 0x1f) == 0x1f) {
+      uint32 number = 0;
+      unsigned count = 0;
+      octet o;
+
+      do {
+        if (++count > 4)
+          throw std::runtime_error("bad TBF value");
+        o = get(p, _limit);
+        number = (number << 7) | (o & 0x7f);
+      } while (o & 0x80);
+
+      _tag = Tag(tc, number);
+    } else {
+      _tag = Tag(tc, t & 0x1f);
+    }
+
+    octet l = get(p, _limit);
+
+    if (l == 0x80) {
+      if (!_constructed)
+        throw std::runtime_error("indefinite length on primitive value");
+      _indefinite = true;
+    } else if (l < 0x80) {
+      _length = l;
+    } else {
+      unsigned count = l & 0x7f;
+
+      if (count > sizeof(size_t) || l == 0xff)
+        throw std::runtime_error("bad length value");
+
+      while (count--)
+        _length = (_length << 8) | get(p, _limit);
+    }
+
+    _value = p;
+
+    if (!_indefinite && _length > static_cast<size_t>(_limit - _value))
+      throw std::runtime_error("out of bounds");
+  }
+
+  // Find the End of Contents octets that terminate an indefinite value
+  const octet *contents_end() const {
+    if (!_indefinite)
+      return _value + _length;
+
+    const octet *p = _value;
+    unsigned depth = 0;
+
+    for (;;) {
+      if (p >= _limit)
+        throw std::runtime_error("missing End of Contents");
+
+      if (!*p) {
+        if (_limit - p < 2 || p[1])
+          throw std::runtime_error("bad length on End of Contents tag");
+        if (!depth)
+          return p;
+        --depth;
+        p += 2;
+        continue;
+      }
+
+      ber_view child(p, _limit, false);
+
+      if (child._indefinite) {
+        ++depth;
+        p = child._value;
+      } else {
+        p = child._value + child._length;
+      }
+    }
+  }
+
+  const octet *element_end() const {
+    if (!_indefinite)
+      return _value + _length;
+    return contents_end() + 2;
+  }
+
+public:
+  ber_view()
+    : _ptr(nullptr), _limit(nullptr), _value(nullptr), _length(0),
+      _constructed(false), _indefinite(false), _in_indefinite(false) {}
+
+  // View the first TLV in the given buffer
+  ber_view(const octet *data, size_t len)
+    : _ptr(data), _limit(data + len), _value(nullptr), _length(0),
+      _constructed(false), _indefinite(false), _in_indefinite(false) {
+    parse();
+  }
+  explicit ber_view(const octet_span &s)
+    : _ptr(s.data()), _limit(s.end()), _value(nullptr), _length(0),
+      _constructed(false), _indefinite(false), _in_indefinite(false) {
+    parse();
+  }
+
+  bool valid() const { return _ptr != nullptr; }
+  explicit operator bool() const { return valid(); }
+
+  Tag tag() const { return _tag; }
+  bool constructed() const { return _constructed; }
+  bool indefinite() const { return _indefinite; }
+  size_t header_length() const { return _value - _ptr; }
+
+  // The contents octets (excluding any End of Contents)
+  octet_span value() const {
+    return octet_span(_value, contents_end());
+  }
+
+  // The complete encoding, from the identifier octets to the end
+  octet_span encoding() const {
+    return octet_span(_ptr, element_end());
+  }
+
+  ber_view first_child() const {
+    if (!_constructed)
+      return ber_view();
+    return ber_view(_value, _indefinite ? _limit : _value + _length,
+                    _indefinite);
+  }
+
+  ber_view next_sibling() const {
+    if (!valid())
+      return ber_view();
+    return ber_view(element_end(), _limit, _in_indefinite);
+  }
+};
+
+END_ASN1_NS
+
+#endif /* ASN1_BER_VIEW_H_ */
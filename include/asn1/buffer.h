@@ -176,14 +176,34 @@ public:
   ~buffer() { a.release(b, e - b); }
 
   const octet *data() const { return b; }
+  octet *data() { return b; }
   size_t capacity() const { return e - b; }
   size_t length() const { return p - b; }
+  // Discard the contents, keeping the storage for reuse
+  void clear() { p = b; }
+  // Drop everything after the first len octets
+  void truncate(size_t len) {
+    if (len < length())
+      p = b + len;
+  }
   void reserve(size_t space) {
     if (static_cast<size_t>(e - p) < space)
       grow (space);
   }
   reader begin() const;
 
+  /* Direct writes: prepare(n) makes room for n octets and returns where
+     they go; commit(n) then appends the first n of them (which may be
+     fewer than were prepared).  This lets encoders assemble several
+     fields in a register and write them with one store. */
+  octet *prepare (size_t n) {
+    reserve (n);
+    return p;
+  }
+  void commit (size_t n) {
+    p += n;
+  }
+
   void put_octet (octet o) {
     if (p >= e) grow();
     *p++ = o;
@@ -237,27 +257,42 @@ public:
     put_octets (other.data(), other.length());
   }
 
-  buffer(const buffer &other) : b(0), p(0), e(0) {
+  buffer(const buffer &other) : a(other.a), b(0), p(0), e(0) {
     put_buffer (other);
   }
 
-  buffer(buffer &&other) : b(other.b), p(other.p), e(other.e) {
+  buffer(buffer &&other) : a(other.a), b(other.b), p(other.p), e(other.e) {
     other.b = other.p = other.e = 0;
   }
 
   buffer &operator=(const buffer &other) {
-    size_t len = other.length();
-    resize(other.length());
-    std::memcpy (p, other.p, len);
+    if (this != &other) {
+      clear();
+      put_buffer (other);
+    }
     return *this;
   }
   buffer &operator=(buffer &&other) {
+    if (this == &other)
+      return *this;
+    if (&a != &other.a)
+      return *this = static_cast<const buffer &>(other);
+    a.release (b, e - b);
     b = other.b;
     p = other.p;
     e = other.e;
     other.b = other.p = other.e = 0;
     return *this;
   }
+
+  // Exchange contents and storage; both must use the same allocator
+  void swap(buffer &other) {
+    if (&a != &other.a)
+      throw std::runtime_error("Cannot swap buffers with different allocators");
+    std::swap (b, other.b);
+    std::swap (p, other.p);
+    std::swap (e, other.e);
+  }
 };
 
 template <class Endian>
@@ -279,36 +314,28 @@ inline bool operator<(const buffer<Endian> &a,
                       const buffer<Endian> &b)
 {
   size_t mlen = std::min(a.length(), b.length());
-  if (std::memcmp (a.data(), b.data(), mlen) < 0)
-    return true;
+  int r = mlen ? std::memcmp (a.data(), b.data(), mlen) : 0;
+  if (r != 0)
+    return r < 0;
   return a.length() < b.length();
 }
 template <class Endian>
 inline bool operator<=(const buffer<Endian> &a,
                        const buffer<Endian> &b)
 {
-  size_t mlen = std::min(a.length(), b.length());
-  if (std::memcmp (a.data(), b.data(), mlen) <= 0)
-    return true;
-  return a.length() <= b.length();
+  return !(b < a);
 }
 template <class Endian>
 inline bool operator>(const buffer<Endian> &a, 
                       const buffer<Endian> &b)
 {
-  size_t mlen = std::min(a.length(), b.length());
-  if (std::memcmp (a.data(), b.data(), mlen) > 0)
-    return true;
-  return a.length() > b.length();
+  return b < a;
 }
 template <class Endian>
 inline bool operator>=(const buffer<Endian> &a,
                        const buffer<Endian> &b)
 {
-  size_t mlen = std::min(a.length(), b.length());
-  if (std::memcmp (a.data(), b.data(), mlen) >= 0)
-    return true;
-  return a.length() >= b.length();
+  return !(a < b);
 }
 
 template <class Endian>
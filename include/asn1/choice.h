@@ -7,6 +7,9 @@
 #include "Tag.h"
 #include "traits.h"
 #include "DEREncoder.h"
+#include "BERDecoder.h"
+
+#include <algorithm>
 
 BEGIN_ASN1_NS
 
@@ -37,6 +40,8 @@ protected:
   void *_ptr;
 
   void assign() {}
+  virtual void clear() { _ptr = nullptr; }
+  static void *copy(Tag, const void *) { return nullptr; }
 
 protected:
   choice(Tag t, void *ptr) : _tag(t), _ptr(ptr) {}
@@ -56,11 +61,25 @@ protected:
   using choice<Tail...>::assign;
   void assign(const Head &h);
 
+  // Returns a copy of the value p points to, which has tag t
+  static void *copy(Tag t, const void *p);
+
+  choice(Tag t, void *ptr) : choice<Tail...>(t, ptr) { }
+
 public:
   choice() : choice<Tail...>() { }
   choice(const Head &h) : choice<Tail...>(traits<Head>::tag, new Head(h)) { }
+  choice(const choice &o)
+    : choice<Tail...>(o._tag, o._ptr ? copy(o._tag, o._ptr) : nullptr) { }
+  choice(choice &&o) : choice<Tail...>(o._tag, o._ptr) {
+    o._tag = tNull;
+    o._ptr = nullptr;
+  }
   ~choice();
 
+  choice &operator=(const choice &o);
+  choice &operator=(choice &&o);
+
   template <typename T>
   choice &operator=(const T &v) {
     assign (v);
@@ -77,11 +96,42 @@ choice<Head, Tail...>::~choice() {
 
 template<typename Head, typename... Tail>
 void choice<Head, Tail...>::clear() {
-  if (this->_ptr) {
-    if (this->_tag == traits<Head>::tag)
-      delete (Head *)this->_ptr;
+  if (this->_ptr && this->_tag == traits<Head>::tag) {
+    delete (Head *)this->_ptr;
     this->_ptr = nullptr;
+  } else {
+    choice<Tail...>::clear();
+  }
+}
+
+template<typename Head, typename... Tail>
+void *choice<Head, Tail...>::copy(Tag t, const void *p) {
+  if (t == traits<Head>::tag)
+    return new Head(*(const Head *)p);
+  return choice<Tail...>::copy(t, p);
+}
+
+template<typename Head, typename... Tail>
+choice<Head, Tail...> &choice<Head, Tail...>::operator=(const choice &o) {
+  if (this != &o) {
+    void *p = o._ptr ? copy(o._tag, o._ptr) : nullptr;
+    this->clear();
+    this->_tag = o._tag;
+    this->_ptr = p;
   }
+  return *this;
+}
+
+template<typename Head, typename... Tail>
+choice<Head, Tail...> &choice<Head, Tail...>::operator=(choice &&o) {
+  if (this != &o) {
+    this->clear();
+    this->_tag = o._tag;
+    this->_ptr = o._ptr;
+    o._tag = tNull;
+    o._ptr = nullptr;
+  }
+  return *this;
 }
 
 inline DEREncoder &operator<<(DEREncoder &e, const choice<> &c) {
@@ -94,7 +144,7 @@ template<typename Head, typename... Tail>
 inline DEREncoder &operator<<(DEREncoder &e, const choice<Head, Tail...> &c) {
   if (c.tag() == traits<Head>::tag)
     return e << (Head)c;
-  return e << (choice<Tail...>)c;
+  return e << static_cast<const choice<Tail...> &>(c);
 }
 
 template <typename Head, typename... Tail>
@@ -114,6 +164,92 @@ inline choice<Head, Tail...>::operator Head&() const
   return *(Head *)this->_ptr;
 }
 
+/* Decoding a choice peeks at the tag, then jumps straight to the right
+   alternative through a table indexed by tag class and number, which is
+   generated from the list of alternatives the first time it is used.
+   Tag numbers of 31 and above don't fit in the table, so we look those
+   up linearly.  If more than one alternative has the same tag, the
+   first one wins, as for encoding. */
+template <typename... Types>
+class choice_decoder
+{
+public:
+  typedef void (*decode_fn)(BERDecoder &, choice<Types...> &);
+
+private:
+  static const unsigned table_size = 128;
+
+  static unsigned slot(Tag t) { return (t.tagClass << 5) | t.number; }
+
+  template <typename T>
+  static void decode(BERDecoder &d, choice<Types...> &c) {
+    T v{};
+    d >> v;
+    if (!d.failed())
+      c = v;
+  }
+
+  template <typename T>
+  static void insert(decode_fn *slots) {
+    Tag t = traits<T>::tag;
+    if (t.number < 31 && !slots[slot(t)])
+      slots[slot(t)] = &decode<T>;
+  }
+
+  template <typename T>
+  static void match(Tag t, decode_fn &f) {
+    if (!f && traits<T>::tag == t)
+      f = &decode<T>;
+  }
+
+  struct table {
+    decode_fn slots[table_size];
+
+    table() {
+      std::fill (slots, slots + table_size, (decode_fn)nullptr);
+      int expand[] = { 0, (insert<Types>(slots), 0)... };
+      (void)expand;
+    }
+  };
+
+  static const table &get_table() {
+    static const table t;
+    return t;
+  }
+
+public:
+  // Returns nullptr if no alternative has tag t
+  static decode_fn find(Tag t) {
+    if (t.number < 31)
+      return get_table().slots[slot(t)];
+
+    decode_fn f = nullptr;
+    int expand[] = { 0, (match<Types>(t, f), 0)... };
+    (void)expand;
+    return f;
+  }
+};
+
+template <typename... Types>
+BERDecoder &operator>>(BERDecoder &d, choice<Types...> &c) {
+  PrimitiveOrConstructed pc;
+  Tag t = d.peekTag (pc);
+
+  if (d.failed())
+    return d;
+
+  typename choice_decoder<Types...>::decode_fn f
+    = choice_decoder<Types...>::find (t);
+
+  if (!f) {
+    d.fail (BERDecoder::UNEXPECTED_TAG, "no alternative of choice has tag");
+    return d;
+  }
+
+  f (d, c);
+  return d;
+}
+
 END_ASN1_NS
 
 #endif
@@ -3,6 +3,18 @@
 #ifndef ASN1_MACHINE_H_
 #define ASN1_MACHINE_H_
 
+/* Where the compiler has builtins for the bit operations below we use
+   them, which gives single instructions (lzcnt, tzcnt, popcnt, bswap and
+   their equivalents) wherever the target has them; otherwise we fall back
+   to portable code.  Define ASN1_NO_BUILTINS to force the portable code. */
+#if !defined(ASN1_NO_BUILTINS) && (defined(__GNUC__) || defined(__clang__))
+#  define ASN1_GCC_BUILTINS 1
+#elif !defined(ASN1_NO_BUILTINS) && defined(_MSC_VER)
+#  define ASN1_MSVC_BUILTINS 1
+#  include <intrin.h>
+#  include <stdlib.h>
+#endif
+
 namespace asn1 {
 
 namespace machine {
@@ -76,6 +88,20 @@ const unsigned word_bits = word_size * 8;
 const uword top_bit = static_cast<uword>(1) << (word_bits - 1);
 const uword all_ones = ~static_cast<uword>(0);
 
+/* Bit twiddling.  clz() and ctz() of zero are defined, and give the
+   width of the type; some callers rely on that. */
+
+// GCC turns __builtin_popcount into a library call unless popcnt is there
+#if defined(ASN1_GCC_BUILTINS) \
+  && (defined(__POPCNT__) || !(defined(__i386__) || defined(__x86_64__)))
+inline uint32 pop (uint32 i) {
+  return __builtin_popcount (i);
+}
+
+inline uint64 pop (uint64 i) {
+  return __builtin_popcountll (i);
+}
+#else
 inline uint32 pop (uint32 i) {
   i = ((i >> 1) & 0x55555555) + (i & 0x55555555);
   i = ((i >> 2) & 0x33333333) + (i & 0x33333333);
@@ -89,12 +115,32 @@ inline uint64 pop (uint64 i) {
   return (pop(static_cast<uint32>(i >> 32))
           + pop(static_cast<uint32>(i)));
 }
+#endif
 
+/* The byte order is fixed at compile time where the compiler tells us
+   what it is, so that to_be() and friends reduce to a bswap or nothing */
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)
+constexpr bool is_big_endian() {
+  return __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+}
+#elif defined(_WIN32)
+constexpr bool is_big_endian() { return false; }
+#else
 inline bool is_big_endian() {
   union { uint32 i; uint8 c[4]; } bint = { 0x01020304 };
   return bint.c[0] == 1;
 }
-
+#endif
+
+#if defined(ASN1_GCC_BUILTINS)
+inline uint16 bswap (uint16 i) { return __builtin_bswap16 (i); }
+inline uint32 bswap (uint32 i) { return __builtin_bswap32 (i); }
+inline uint64 bswap (uint64 i) { return __builtin_bswap64 (i); }
+#elif defined(ASN1_MSVC_BUILTINS)
+inline uint16 bswap (uint16 i) { return _byteswap_ushort (i); }
+inline uint32 bswap (uint32 i) { return _byteswap_ulong (i); }
+inline uint64 bswap (uint64 i) { return _byteswap_uint64 (i); }
+#else
 // These are intended to be obvious to the compiler
 inline uint16 bswap (uint16 i) {
   return ((i & 0xff00) >> 8) | ((i & 0xff) << 8); 
@@ -115,7 +161,44 @@ inline uint64 bswap (uint64 i) {
           | ((i & 0x000000000000ff00) << 40)
           | ((i & 0x00000000000000ff) << 56));
 }
+#endif
 
+#if defined(ASN1_GCC_BUILTINS)
+/* The builtins are undefined for zero; with lzcnt/tzcnt available the
+   compiler folds the test away */
+inline uint32 clz (uint32 i) { return i ? __builtin_clz (i) : 32; }
+inline uint64 clz (uint64 i) { return i ? __builtin_clzll (i) : 64; }
+inline uint32 ctz (uint32 i) { return i ? __builtin_ctz (i) : 32; }
+inline uint64 ctz (uint64 i) { return i ? __builtin_ctzll (i) : 64; }
+#elif defined(ASN1_MSVC_BUILTINS)
+inline uint32 clz (uint32 i) {
+  unsigned long n;
+  return _BitScanReverse (&n, i) ? 31 - n : 32;
+}
+inline uint32 ctz (uint32 i) {
+  unsigned long n;
+  return _BitScanForward (&n, i) ? n : 32;
+}
+#  if defined(_WIN64)
+inline uint64 clz (uint64 i) {
+  unsigned long n;
+  return _BitScanReverse64 (&n, i) ? 63 - n : 64;
+}
+inline uint64 ctz (uint64 i) {
+  unsigned long n;
+  return _BitScanForward64 (&n, i) ? n : 64;
+}
+#  else
+inline uint64 clz (uint64 i) {
+  uint32 hi = static_cast<uint32>(i >> 32);
+  return hi ? clz(hi) : 32 + clz(static_cast<uint32>(i));
+}
+inline uint64 ctz (uint64 i) {
+  uint32 lo = static_cast<uint32>(i);
+  return lo ? ctz(lo) : 32 + ctz(static_cast<uint32>(i >> 32));
+}
+#  endif
+#else
 inline uint32 clz (uint32 i) {
   i |= i >> 1; i |= i >> 2;
   i |= i >> 4; i |= i >> 8;
@@ -125,7 +208,6 @@ inline uint32 clz (uint32 i) {
 
   return pop(i);
 }
-inline uint32 clz (int32 i) { return clz(static_cast<uint32>(i)); }
 
 inline uint64 clz (uint64 i) {
   i |= i >> 1; i |= i >> 2;
@@ -136,7 +218,6 @@ inline uint64 clz (uint64 i) {
 
   return pop(i);
 }
-inline uint64 clz (int64 i) { return clz(static_cast<uint64>(i)); }
 
 inline uint32 ctz (uint32 i) {
   i |= i << 1; i |= i << 2;
@@ -147,7 +228,6 @@ inline uint32 ctz (uint32 i) {
 
   return pop(i);
 }
-inline uint32 ctz (int32 i) { return ctz(static_cast<uint32>(i)); }
 
 inline uint64 ctz (uint64 i) {
   i |= i << 1; i |= i << 2;
@@ -158,7 +238,12 @@ inline uint64 ctz (uint64 i) {
 
   return pop(i);
 }
-inline uint64 ctz (int64 i) { return clz(static_cast<uint64>(i)); }
+#endif
+
+inline uint32 clz (int32 i) { return clz(static_cast<uint32>(i)); }
+inline uint64 clz (int64 i) { return clz(static_cast<uint64>(i)); }
+inline uint32 ctz (int32 i) { return ctz(static_cast<uint32>(i)); }
+inline uint64 ctz (int64 i) { return ctz(static_cast<uint64>(i)); }
 
 inline uint16 to_be(uint16 i) {
   if (is_big_endian()) return i; else return bswap(i);
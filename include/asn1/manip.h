@@ -10,6 +10,9 @@
 
 BEGIN_ASN1_NS
 
+class DERBackEncoder;
+class CERStreamEncoder;
+
 class tag {
 private:
   Tag _t;
@@ -19,6 +22,8 @@ public:
   tag(Tag t, PrimitiveOrConstructed c = PRIMITIVE) : _t(t), _c(c) {}
 
   friend DEREncoder &operator<< (DEREncoder &e, tag t);
+  friend DERBackEncoder &operator<< (DERBackEncoder &e, tag t);
+  friend CERStreamEncoder &operator<< (CERStreamEncoder &e, tag t);
   friend BERDecoder &operator>> (BERDecoder &d, tag t);
 };
 
@@ -32,7 +37,7 @@ inline DEREncoder &operator<< (DEREncoder &e, tag t) {
   e.overrideNextTag (t._t, t._c);
   return e;
 }
-inline BERDecoder &operator>> (BERDecoder &e, tag t) {
+inline BERDecoder &operator>> (BERDecoder &d, tag t) {
   d.overrideNextTag (t._t, t._c);
   return d;
 }
@@ -64,8 +69,7 @@ inline DEREncoder &operator<< (DEREncoder &e, instance_of i) {
 
    std::cout << i.oid(); */
 inline BERDecoder &operator>> (BERDecoder &d, instance_of &i) {
-  d.expectTag (tInstanceOf);
-  uint32 len = d.decodeLength();
+  size_t len = d.expectHeader (tInstanceOf);
   d.pushState (false, len);
   d >> i._o;
   return d;
@@ -76,15 +80,14 @@ class enumerated {
 private:
   Enum _e;
 public:
-  enumerated(const enumerated<Enum> &o) : _i(o._e) {}
+  enumerated(const enumerated<Enum> &o) : _e(o._e) {}
   enumerated(enumerated<Enum> &&o) : _e(std::move(o._e)) {}
   explicit enumerated(Enum e) : _e(e) {}
 
   operator Enum() const { return _e; }
-  enumerated &operator=(Enum e) { _e = e; }
+  enumerated &operator=(Enum e) { _e = e; return *this; }
 
   friend DEREncoder &operator<< (DEREncoder &e, enumerated<Enum> en);
-  friend BERDecoder &operator>> (BERDecoder &d, enumerated<Enum> &en);
 };
 
 /* Sadly there's no way to have a base class for enums, or for a template to
@@ -108,8 +111,31 @@ DEREncoder &operator<< (DEREncoder &e, enumerated<Enum> en) {
 template <class Enum>
 BERDecoder &operator>> (BERDecoder &d, enumerated<Enum> &en)
 {
-  e.overrideNextTag (tEnumerated, PRIMITIVE);
-  return d >> en._e;
+  int64 v;
+  d.overrideNextTag (tEnumerated, PRIMITIVE);
+  d >> v;
+  en = static_cast<Enum>(v);
+  return d;
+}
+
+/* SEQUENCE OF ENUMERATED uses the same bulk decoder as SEQUENCE OF
+   INTEGER (see BERDecoder.h). */
+template <class Enum, class A>
+BERDecoder &operator>> (BERDecoder &d, std::vector<enumerated<Enum>, A> &v)
+{
+  d >> sequence;
+  for (;;) {
+    d.decodeIntegerRun<int64> (0x0a, v, [](int64 i) {
+        return enumerated<Enum>(static_cast<Enum>(i));
+      });
+    if (d.atEnd())
+      break;
+    enumerated<Enum> val(static_cast<Enum>(0));
+    d >> val;
+    v.push_back(val);
+  }
+  d >> end;
+  return d;
 }
 
 END_ASN1_NS
@@ -0,0 +1,75 @@
+/* Emacs, this is -*-C++-*- */
+
+#ifndef ASN1_MAPPED_FILE_H_
+#define ASN1_MAPPED_FILE_H_
+
+#include "base.h"
+
+#include <cstddef>
+#include <string>
+
+BEGIN_ASN1_NS
+
+/* A read-only memory mapping of an entire file, so that large archives of
+   BER or DER records can be decoded in place rather than being read into
+   heap buffers first, e.g.
+
+     asn1::mapped_file f("records.ber");
+     asn1::BERDecoder d(f.data(), f.size());
+
+   The mapping is released when the object is destroyed, so it must
+   outlive any decoder, ber_view or span that refers to it. */
+class mapped_file
+{
+public:
+  typedef enum {
+    SEQUENTIAL = 0,  // The file will mostly be read from start to end
+    RANDOM = 1       // The file will be accessed in no particular order
+  } AccessPattern;
+
+private:
+  const octet *_data;
+  size_t       _size;
+  void        *_handle;
+
+  mapped_file(const mapped_file &);
+  mapped_file &operator=(const mapped_file &);
+
+  void map(const std::string &path, AccessPattern pattern);
+  void unmap();
+
+public:
+  explicit mapped_file(const std::string &path,
+                       AccessPattern pattern = SEQUENTIAL)
+    : _data(nullptr), _size(0), _handle(nullptr) {
+    map (path, pattern);
+  }
+  mapped_file(mapped_file &&other)
+    : _data(other._data), _size(other._size), _handle(other._handle) {
+    other._data = nullptr;
+    other._size = 0;
+    other._handle = nullptr;
+  }
+  ~mapped_file() { unmap(); }
+
+  mapped_file &operator=(mapped_file &&other) {
+    if (this != &other) {
+      unmap();
+      _data = other._data;
+      _size = other._size;
+      _handle = other._handle;
+      other._data = nullptr;
+      other._size = 0;
+      other._handle = nullptr;
+    }
+    return *this;
+  }
+
+  const octet *data() const { return _data; }
+  size_t size() const { return _size; }
+  size_t length() const { return _size; }
+};
+
+END_ASN1_NS
+
+#endif /* ASN1_MAPPED_FILE_H_ */
@@ -0,0 +1,190 @@
+/* Emacs, this is -*-C++-*- */
+
+#ifndef ASN1_PARALLEL_H_
+#define ASN1_PARALLEL_H_
+
+#include "base.h"
+#include "span.h"
+#include "buffer.h"
+#include "DEREncoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+BEGIN_ASN1_NS
+
+namespace detail {
+  struct encode_element {
+    template <class T>
+    void operator()(DEREncoder &e, const T &v) const { e << v; }
+  };
+}
+
+/* Encodes the contents of a large SEQUENCE OF on a pool of threads.  The
+   elements are split into contiguous chunks, each chunk is encoded by its
+   own DEREncoder, and the chunks are then stitched together, in order,
+   behind a single header, e.g.
+
+     std::vector<Record> records = ...;
+     asn1::parallel_sequence_of p;
+     asn1::DEREncoder e;
+
+     p.encode (records.begin(), records.end());
+     e << p;
+
+     std::vector<struct iovec> iov;
+     e.gather (iov);
+     writev (fd, iov.data(), iov.size());
+
+   Writing p to an encoder references the chunks rather than copying them
+   (see DEREncoder::encodeReference()), so p must outlive the encoder's use
+   of them; copyTo() copies them instead, leaving an encoding that asDER()
+   can return.  The chunk encoders are reset and reused by the next call
+   to encode(), so a long-lived parallel_sequence_of soon stops allocating.
+   If threads is zero, we use one per hardware thread.  The allocator is
+   shared by all the threads, so it must be thread-safe; the ones in
+   buffer.h are. */
+class parallel_sequence_of
+{
+private:
+  unsigned                                  _threads;
+  allocator                                 &_alloc;
+  std::vector<std::unique_ptr<DEREncoder> > _parts;
+  std::vector<octet_span>                   _runs;
+  size_t                                    _length;
+
+public:
+  parallel_sequence_of(unsigned threads = 0,
+                       allocator &alloc = dynamic_allocator)
+    : _threads(threads), _alloc(alloc), _length(0) {}
+
+  /* Encode the elements [first, last), which must be random access.  f is
+     called as
+
+       f(asn1::DEREncoder &e, const T &element)
+
+     concurrently from several threads, so it must be thread-safe; it
+     should encode one element, complete, into e.  If f throws, the
+     remaining chunks are abandoned and the first exception is rethrown on
+     the calling thread once all the workers have stopped. */
+  template <class Iter, class F>
+  void encode(Iter first, Iter last, F f);
+
+  // As above, encoding each element with operator<<
+  template <class Iter>
+  void encode(Iter first, Iter last) {
+    encode (first, last, detail::encode_element());
+  }
+
+  // The length of the contents, i.e. of all the elements together
+  size_t length() const { return _length; }
+
+  // The encoded elements, in order, as runs of octets
+  const std::vector<octet_span> &runs() const { return _runs; }
+
+  // Encode the SEQUENCE OF into e, copying the elements
+  void copyTo(DEREncoder &e) const {
+    if (_length > 0xffffffff)
+      throw std::runtime_error("DER encoding too long");
+    e.encodeHeader (tSequence, (uint32)_length, CONSTRUCTED);
+    for (auto r = _runs.begin(); r < _runs.end(); ++r)
+      e.encodeOctets (r->data(), r->size());
+  }
+};
+
+template <class Iter, class F>
+void parallel_sequence_of::encode(Iter first, Iter last, F f)
+{
+  size_t count = last - first;
+  unsigned threads = _threads;
+
+  if (!threads)
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  // A few chunks per thread, so that one slow chunk doesn't hold up the rest
+  size_t chunks = threads > 1 ? threads * 4 : 1;
+  if (chunks > count)
+    chunks = count ? count : 1;
+
+  while (_parts.size() < chunks)
+    _parts.push_back(std::unique_ptr<DEREncoder>(new DEREncoder(_alloc)));
+
+  std::atomic<size_t> next(0);
+  std::atomic<bool>   failed(false);
+  std::exception_ptr  error;
+  std::mutex          error_lock;
+
+  auto worker = [&] () {
+    try {
+      size_t n;
+
+      while (!failed && (n = next.fetch_add(1)) < chunks) {
+        DEREncoder &e = *_parts[n];
+        Iter i = first + count * n / chunks;
+        Iter end = first + count * (n + 1) / chunks;
+
+        e.reset();
+        for (; i != end; ++i)
+          f(e, *i);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(error_lock);
+      if (!error)
+        error = std::current_exception();
+      failed = true;
+    }
+  };
+
+  std::vector<std::thread> pool;
+
+  // As in decode_records(), make do with whatever threads we can start
+  pool.reserve(std::min<size_t>(threads, chunks) - 1);
+  try {
+    for (unsigned n = 1; n < threads && n < chunks; ++n)
+      pool.emplace_back(worker);
+  } catch (const std::system_error &) {
+  }
+
+  // The calling thread does its share too
+  worker();
+
+  for (auto t = pool.begin(); t != pool.end(); ++t)
+    t->join();
+
+  _runs.clear();
+  _length = 0;
+
+  if (error)
+    std::rethrow_exception(error);
+
+  // Stitch the chunks together in order
+  try {
+    for (size_t n = 0; n < chunks; ++n) {
+      _parts[n]->gather (_runs);
+      _length += _parts[n]->encodedLength();
+    }
+  } catch (...) {
+    _runs.clear();
+    _length = 0;
+    throw;
+  }
+}
+
+/* Encode p's SEQUENCE OF, referencing the elements rather than copying
+   them; use gather() to write the result out */
+inline DEREncoder &operator<< (DEREncoder &e, const parallel_sequence_of &p) {
+  const std::vector<octet_span> &runs = p.runs();
+
+  e.encodeReferences (tSequence, runs.data(), runs.data() + runs.size());
+  return e;
+}
+
+END_ASN1_NS
+
+#endif /* ASN1_PARALLEL_H_ */
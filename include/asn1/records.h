@@ -0,0 +1,118 @@
+/* Emacs, this is -*-C++-*- */
+
+#ifndef ASN1_RECORDS_H_
+#define ASN1_RECORDS_H_
+
+#include "base.h"
+#include "span.h"
+#include "ber_view.h"
+#include "BERDecoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+BEGIN_ASN1_NS
+
+/* Many log and archive formats are just long runs of top-level BER TLVs.
+   split_records() makes a quick pass over such a buffer, looking only at
+   the tag and length octets, and appends the extent of each record to
+   the supplied vector, e.g.
+
+     asn1::mapped_file f("log.ber");
+     std::vector<asn1::octet_span> records;
+
+     asn1::split_records (f.data(), f.size(), records);
+
+   Indefinite length records have to be walked to find their End of
+   Contents, but nothing is decoded or copied.  Malformed headers throw
+   std::runtime_error. */
+inline void split_records(const octet *data, size_t len,
+                          std::vector<octet_span> &records)
+{
+  const octet *end = data + len;
+  const octet *ptr = data;
+
+  while (ptr < end) {
+    octet_span r = ber_view(ptr, end - ptr).encoding();
+    records.push_back(r);
+    ptr = r.end();
+  }
+}
+
+/* Decode previously split records on a pool of threads, each with its
+   own BERDecoder.  f is called as
+
+     f(asn1::BERDecoder &d, size_t index)
+
+   concurrently from several threads, so it must be thread-safe; index is
+   the record's position in the records vector.  If threads is zero, we
+   use one per hardware thread.  If f throws, the remaining records are
+   abandoned and the first exception is rethrown on the calling thread
+   once all the workers have stopped. */
+template <class F>
+void decode_records(const std::vector<octet_span> &records, F f,
+                    unsigned threads = 0)
+{
+  // Hand out records in batches to keep contention on next low
+  const size_t batch = 64;
+
+  std::atomic<size_t> next(0);
+  std::atomic<bool>   failed(false);
+  std::exception_ptr  error;
+  std::mutex          error_lock;
+
+  if (!threads)
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  auto worker = [&] () {
+    try {
+      while (!failed) {
+        size_t first = next.fetch_add(batch);
+
+        if (first >= records.size())
+          break;
+
+        size_t last = std::min(first + batch, records.size());
+
+        for (size_t n = first; n < last; ++n) {
+          BERDecoder d(records[n].data(), records[n].size());
+          f(d, n);
+        }
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(error_lock);
+      if (!error)
+        error = std::current_exception();
+      failed = true;
+    }
+  };
+
+  std::vector<std::thread> pool;
+
+  /* If a thread can't be started, make do with the ones that were; with
+     room reserved, nothing else here can throw and leave one unjoined */
+  pool.reserve(threads - 1);
+  try {
+    for (unsigned n = 1; n < threads; ++n)
+      pool.emplace_back(worker);
+  } catch (const std::system_error &) {
+  }
+
+  // The calling thread does its share too
+  worker();
+
+  for (auto t = pool.begin(); t != pool.end(); ++t)
+    t->join();
+
+  if (error)
+    std::rethrow_exception(error);
+}
+
+END_ASN1_NS
+
+#endif /* ASN1_RECORDS_H_ */
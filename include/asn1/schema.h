@@ -0,0 +1,513 @@
+/* Emacs, this is -*-C++-*- */
+
+#ifndef ASN1_SCHEMA_H_
+#define ASN1_SCHEMA_H_
+
+#include "base.h"
+#include "Tag.h"
+#include "traits.h"
+#include "span.h"
+#include "string_view.h"
+#include "segments.h"
+#include "BERDecoder.h"
+#include "DEREncoder.h"
+
+#include <limits>
+
+BEGIN_ASN1_NS
+
+/* Compile-time descriptions of SEQUENCE types.  Rather than hand-writing
+
+     e << asn1::sequence << a.id << a.name << asn1::end;
+
+   and a matching decoder for every message, you describe the SEQUENCE
+   once, e.g.
+
+     struct Account {
+       asn1::int32                       id;
+       asn1::IA5String                   name;
+       asn1::schema::opt<asn1::int64>    balance;
+       bool                              active;
+     };
+
+     namespace s = asn1::schema;
+
+     typedef s::sequence<Account,
+       s::field<Account, asn1::int32, &Account::id>,
+       s::field<Account, asn1::IA5String, &Account::name,
+                s::implicit_tag<0> >,
+       s::optional_field<Account, asn1::int64, &Account::balance,
+                         s::explicit_tag<1> >,
+       s::default_field<Account, bool, &Account::active, true>
+     > AccountSchema;
+
+     inline asn1::DEREncoder &operator<<(asn1::DEREncoder &e,
+                                         const Account &a) {
+       return AccountSchema::encode (e, a);
+     }
+     inline asn1::BERDecoder &operator>>(asn1::BERDecoder &d, Account &a) {
+       return AccountSchema::decode (d, a);
+     }
+
+   The identifier octets for every field are worked out at compile time.
+   BOOLEAN and INTEGER fields are written and matched directly using
+   those octets, without going through the tag override machinery, and
+   the encoder reserves space for all of them in one go.  Other fields
+   use their ordinary operator<< and operator>> (with a tag override if
+   they are IMPLICITly tagged), so nested sequences work as you would
+   expect.
+
+   An untagged OPTIONAL or DEFAULT field of a type other than BOOLEAN or
+   INTEGER needs traits<T>::tag, so that we can tell whether it's
+   present. */
+namespace schema {
+
+// Tagging
+typedef enum {
+  UNTAGGED = 0,
+  IMPLICIT = 1,
+  EXPLICIT = 2
+} TagMode;
+
+struct untagged {
+  static const TagMode  mode = UNTAGGED;
+  static const TagClass tag_class = UNIVERSAL;
+  static const uint32   number = 0;
+};
+
+template <uint32 N, TagClass C = CONTEXT_SPECIFIC>
+struct implicit_tag {
+  static const TagMode  mode = IMPLICIT;
+  static const TagClass tag_class = C;
+  static const uint32   number = N;
+};
+
+template <uint32 N, TagClass C = CONTEXT_SPECIFIC>
+struct explicit_tag {
+  static const TagMode  mode = EXPLICIT;
+  static const TagClass tag_class = C;
+  static const uint32   number = N;
+};
+
+// Pre-encoded identifier octets
+constexpr unsigned identifier_length(uint32 n) {
+  return (n < 31 ? 1
+          : n < (1u << 7) ? 2
+          : n < (1u << 14) ? 3
+          : n < (1u << 21) ? 4
+          : n < (1u << 28) ? 5 : 6);
+}
+
+constexpr octet identifier_octet(TagClass c, uint32 n,
+                                 PrimitiveOrConstructed pc, unsigned i) {
+  return (i >= identifier_length(n) ? 0
+          : !i ? octet((c << 6) | (pc ? 0x20 : 0) | (n < 31 ? n : 0x1f))
+          : octet(((uint64(n) >> (7 * (identifier_length(n) - 1 - i))) & 0x7f)
+                  | (i + 1 < identifier_length(n) ? 0x80 : 0)));
+}
+
+template <TagClass C, uint32 N, PrimitiveOrConstructed PC>
+struct identifier {
+  static constexpr unsigned length = identifier_length(N);
+  static constexpr octet octets[6] = {
+    identifier_octet(C, N, PC, 0), identifier_octet(C, N, PC, 1),
+    identifier_octet(C, N, PC, 2), identifier_octet(C, N, PC, 3),
+    identifier_octet(C, N, PC, 4), identifier_octet(C, N, PC, 5)
+  };
+};
+
+template <TagClass C, uint32 N, PrimitiveOrConstructed PC>
+constexpr unsigned identifier<C, N, PC>::length;
+template <TagClass C, uint32 N, PrimitiveOrConstructed PC>
+constexpr octet identifier<C, N, PC>::octets[6];
+
+/* Whether a type is encoded in primitive or constructed form, which we
+   need to know to apply an IMPLICIT tag.  Anything not listed here is
+   assumed to be a SEQUENCE or SET. */
+template <class T>
+struct form { static const PrimitiveOrConstructed value = CONSTRUCTED; };
+
+#define ASN1_SCHEMA_PRIMITIVE(type)                                     \
+  template <>                                                           \
+  struct form<type> { static const PrimitiveOrConstructed value = PRIMITIVE; };
+
+ASN1_SCHEMA_PRIMITIVE(bool)
+ASN1_SCHEMA_PRIMITIVE(int32)
+ASN1_SCHEMA_PRIMITIVE(uint32)
+ASN1_SCHEMA_PRIMITIVE(int64)
+ASN1_SCHEMA_PRIMITIVE(uint64)
+ASN1_SCHEMA_PRIMITIVE(double)
+ASN1_SCHEMA_PRIMITIVE(OID)
+ASN1_SCHEMA_PRIMITIVE(RelativeOID)
+ASN1_SCHEMA_PRIMITIVE(octet_span)
+ASN1_SCHEMA_PRIMITIVE(octet_segments)
+ASN1_SCHEMA_PRIMITIVE(BMPString)
+ASN1_SCHEMA_PRIMITIVE(UniversalString)
+ASN1_SCHEMA_PRIMITIVE(GeneralString)
+ASN1_SCHEMA_PRIMITIVE(GraphicString)
+ASN1_SCHEMA_PRIMITIVE(IA5String)
+ASN1_SCHEMA_PRIMITIVE(NumericString)
+ASN1_SCHEMA_PRIMITIVE(PrintableString)
+ASN1_SCHEMA_PRIMITIVE(T61String)
+ASN1_SCHEMA_PRIMITIVE(UTF8String)
+ASN1_SCHEMA_PRIMITIVE(VideotexString)
+ASN1_SCHEMA_PRIMITIVE(VisibleString)
+
+#undef ASN1_SCHEMA_PRIMITIVE
+
+template <class A>
+struct form<std::vector<octet, A> > {
+  static const PrimitiveOrConstructed value = PRIMITIVE;
+};
+template <class A>
+struct form<BitString<A> > {
+  static const PrimitiveOrConstructed value = PRIMITIVE;
+};
+template <class S>
+struct form<string_view<S> > {
+  static const PrimitiveOrConstructed value = PRIMITIVE;
+};
+template <class E>
+struct form<enumerated<E> > {
+  static const PrimitiveOrConstructed value = PRIMITIVE;
+};
+
+/* Types whose contents we encode and decode directly.  Each provides the
+   universal tag number, the largest possible contents length, the
+   contents length of a particular value and functions to write and read
+   the contents octets. */
+template <class T>
+struct codec { static const bool direct = false; };
+
+template <>
+struct codec<bool> {
+  static const bool     direct = true;
+  static const uint32   number = 1;
+  static const unsigned max_length = 1;
+
+  static unsigned length(bool) { return 1; }
+  static void encode(DEREncoder &e, bool b, unsigned) {
+    e.encodeOctet (b ? 0xff : 0x00);
+  }
+  static void decode(BERDecoder &d, const octet *p, size_t len, bool &b) {
+    if (len != 1) {
+      d.fail (BERDecoder::BAD_VALUE, "incorrect length for boolean");
+      return;
+    }
+    b = *p ? true : false;
+  }
+};
+
+template <class Int>
+struct integer_codec {
+  static const bool     direct = true;
+  static const uint32   number = 2;
+  static const unsigned max_length
+    = sizeof(Int) + (std::numeric_limits<Int>::is_signed ? 0 : 1);
+
+  static unsigned length(Int i) {
+    if (std::numeric_limits<Int>::is_signed)
+      return DEREncoder::integerLength (int64(i));
+    return DEREncoder::integerLength (uint64(i));
+  }
+
+  static void encode(DEREncoder &e, Int i, unsigned len) {
+    uint64 ibe = machine::to_be (uint64(int64(i)));
+
+    if (len > 8) {
+      e.encodeOctet (0);
+      --len;
+    }
+    e.encodeOctets ((const octet *)&ibe + 8 - len, len);
+  }
+
+  static void decode(BERDecoder &d, const octet *p, size_t len, Int &i) {
+    if (!len || len > max_length
+        || !BERDecoder::decodeIntegerContents<Int> (p, len, len, i))
+      d.fail (BERDecoder::OUT_OF_RANGE, "integer outside range");
+  }
+};
+
+template <> struct codec<int32> : integer_codec<int32> {};
+template <> struct codec<uint32> : integer_codec<uint32> {};
+template <> struct codec<int64> : integer_codec<int64> {};
+template <> struct codec<uint64> : integer_codec<uint64> {};
+
+/* Encodes and decodes one value with the given tagging.  For explicitly
+   tagged values, the outer identifier is always constructed. */
+template <class T, class Tagging, bool Direct = codec<T>::direct>
+struct value_coder;
+
+template <class T, class Tagging>
+struct value_coder<T, Tagging, true>
+{
+  typedef codec<T> C;
+  typedef identifier<Tagging::tag_class, Tagging::number, CONSTRUCTED> outer;
+  typedef identifier<Tagging::mode == IMPLICIT ? Tagging::tag_class
+                     : UNIVERSAL,
+                     Tagging::mode == IMPLICIT ? Tagging::number
+                     : C::number, PRIMITIVE> inner;
+
+  // The contents are short, so the lengths are always one octet
+  static const size_t max_size
+    = (inner::length + 1 + C::max_length
+       + (Tagging::mode == EXPLICIT ? outer::length + 1 : 0));
+
+  static bool next(const BERDecoder &d) {
+    if (Tagging::mode == EXPLICIT)
+      return d.peekOctets (outer::octets, outer::length);
+    return d.peekOctets (inner::octets, inner::length);
+  }
+
+  static void encode(DEREncoder &e, const T &v) {
+    unsigned len = C::length (v);
+
+    if (Tagging::mode == EXPLICIT) {
+      e.encodeOctets (outer::octets, outer::length);
+      e.encodeLength (inner::length + 1 + len);
+    }
+    e.encodeOctets (inner::octets, inner::length);
+    e.encodeLength (len);
+    C::encode (e, v, len);
+  }
+
+  static void decodeValue(BERDecoder &d, T &v) {
+    if (!d.matchOctets (inner::octets, inner::length)) {
+      d.fail (BERDecoder::UNEXPECTED_TAG, "unexpected tag");
+      return;
+    }
+
+    size_t len = d.decodeLength();
+    const octet *p = d.getOctets (len);
+
+    if (p)
+      C::decode (d, p, len, v);
+  }
+
+  static void decode(BERDecoder &d, T &v) {
+    if (Tagging::mode != EXPLICIT) {
+      decodeValue (d, v);
+      return;
+    }
+
+    if (!d.matchOctets (outer::octets, outer::length)) {
+      d.fail (BERDecoder::UNEXPECTED_TAG, "unexpected tag");
+      return;
+    }
+
+    bool indefinite = false;
+    size_t len = d.decodeLengthOrIndefinite (indefinite);
+
+    d.pushState (indefinite, len);
+    decodeValue (d, v);
+    asn1::end (d);
+  }
+};
+
+template <class T, class Tagging>
+struct value_tag {
+  static Tag get() { return Tag(Tagging::tag_class, Tagging::number); }
+};
+template <class T>
+struct value_tag<T, untagged> {
+  static Tag get() { return traits<T>::tag; }
+};
+
+template <class T, class Tagging>
+struct value_coder<T, Tagging, false>
+{
+  typedef identifier<Tagging::tag_class, Tagging::number, CONSTRUCTED> outer;
+
+  static const size_t max_size = 0;
+
+  static bool next(BERDecoder &d) {
+    PrimitiveOrConstructed pc;
+    Tag t = d.peekTag (pc);
+    return !d.failed() && t == value_tag<T, Tagging>::get();
+  }
+
+  static void encode(DEREncoder &e, const T &v) {
+    switch (Tagging::mode) {
+    case UNTAGGED:
+      e << v;
+      break;
+    case IMPLICIT:
+      e.overrideNextTag (Tag(Tagging::tag_class, Tagging::number),
+                         form<T>::value);
+      e << v;
+      break;
+    case EXPLICIT:
+      e.encodeOctets (outer::octets, outer::length);
+      e.pushState (DEREncoder::SEQUENCE);
+      e << v;
+      e.popState ();
+      break;
+    }
+  }
+
+  static void decode(BERDecoder &d, T &v) {
+    switch (Tagging::mode) {
+    case UNTAGGED:
+      d >> v;
+      break;
+    case IMPLICIT:
+      d.overrideNextTag (Tag(Tagging::tag_class, Tagging::number),
+                         form<T>::value);
+      d >> v;
+      break;
+    case EXPLICIT:
+      {
+        if (!d.matchOctets (outer::octets, outer::length)) {
+          d.fail (BERDecoder::UNEXPECTED_TAG, "unexpected tag");
+          return;
+        }
+
+        bool indefinite = false;
+        size_t len = d.decodeLengthOrIndefinite (indefinite);
+
+        d.pushState (indefinite, len);
+        d >> v;
+        asn1::end (d);
+      }
+      break;
+    }
+  }
+};
+
+// The value of an OPTIONAL field
+template <class T>
+class opt
+{
+private:
+  T    _value;
+  bool _present;
+
+public:
+  opt() : _value(), _present(false) {}
+  opt(const T &v) : _value(v), _present(true) {}
+
+  opt &operator=(const T &v) {
+    _value = v;
+    _present = true;
+    return *this;
+  }
+
+  bool present() const { return _present; }
+  explicit operator bool() const { return _present; }
+
+  void reset() { _present = false; }
+
+  // Mark the value present and return it, so it can be filled in place
+  T &emplace() {
+    _present = true;
+    return _value;
+  }
+
+  T &value() { return _value; }
+  const T &value() const { return _value; }
+  T &operator*() { return _value; }
+  const T &operator*() const { return _value; }
+  T *operator->() { return &_value; }
+  const T *operator->() const { return &_value; }
+};
+
+// Field descriptors
+template <class Class, class T, T Class::*Member, class Tagging = untagged>
+struct field {
+  typedef value_coder<T, Tagging> coder;
+
+  static const size_t max_size = coder::max_size;
+
+  static void encode(DEREncoder &e, const Class &c) {
+    coder::encode (e, c.*Member);
+  }
+  static void decode(BERDecoder &d, Class &c) {
+    coder::decode (d, c.*Member);
+  }
+};
+
+template <class Class, class T, opt<T> Class::*Member,
+          class Tagging = untagged>
+struct optional_field {
+  typedef value_coder<T, Tagging> coder;
+
+  static const size_t max_size = coder::max_size;
+
+  static void encode(DEREncoder &e, const Class &c) {
+    const opt<T> &v = c.*Member;
+    if (v.present())
+      coder::encode (e, v.value());
+  }
+  static void decode(BERDecoder &d, Class &c) {
+    opt<T> &v = c.*Member;
+    if (!d.atEnd() && coder::next (d))
+      coder::decode (d, v.emplace());
+    else
+      v.reset();
+  }
+};
+
+// DER requires that a field equal to its DEFAULT is omitted
+template <class Class, class T, T Class::*Member, T Default,
+          class Tagging = untagged>
+struct default_field {
+  typedef value_coder<T, Tagging> coder;
+
+  static const size_t max_size = coder::max_size;
+
+  static void encode(DEREncoder &e, const Class &c) {
+    if (c.*Member != Default)
+      coder::encode (e, c.*Member);
+  }
+  static void decode(BERDecoder &d, Class &c) {
+    if (!d.atEnd() && coder::next (d))
+      coder::decode (d, c.*Member);
+    else
+      c.*Member = Default;
+  }
+};
+
+template <size_t... N>
+struct sum { static const size_t value = 0; };
+template <size_t Head, size_t... Tail>
+struct sum<Head, Tail...> {
+  static const size_t value = Head + sum<Tail...>::value;
+};
+
+// A SEQUENCE of the given fields, in order
+template <class Class, class... Fields>
+struct sequence {
+  // Worst case size of the directly encoded fields
+  static const size_t max_size = sum<Fields::max_size...>::value;
+
+  static DEREncoder &encode(DEREncoder &e, const Class &c) {
+    e.encodeTag (tSequence, CONSTRUCTED);
+    e.pushState (DEREncoder::SEQUENCE);
+    e.reserve (max_size);
+
+    int expand[] = { 0, (Fields::encode (e, c), 0)... };
+    (void)expand;
+
+    e.popState ();
+    return e;
+  }
+
+  static BERDecoder &decode(BERDecoder &d, Class &c) {
+    bool indefinite;
+    size_t len = d.expectHeader (tSequence, CONSTRUCTED, indefinite);
+
+    d.pushState (indefinite, len);
+
+    // Braced initializers are evaluated in order
+    int expand[] = { 0, (Fields::decode (d, c), 0)... };
+    (void)expand;
+
+    return asn1::end (d);
+  }
+};
+
+} // namespace schema
+
+END_ASN1_NS
+
+#endif /* ASN1_SCHEMA_H_ */
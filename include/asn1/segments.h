@@ -0,0 +1,116 @@
+/* Emacs, this is -*-C++-*- */
+
+#ifndef ASN1_SEGMENTS_H_
+#define ASN1_SEGMENTS_H_
+
+#include "base.h"
+#include "span.h"
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+BEGIN_ASN1_NS
+
+/* The contents of an OCTET STRING, BIT STRING or character string, as a
+   list of spans pointing into the buffer being decoded.  In BER (and CER,
+   which splits strings into 1000 octet segments) a string may use the
+   constructed form, in which case its contents are scattered across
+   several primitive segments; BERDecoder::decodeSegments() gathers them
+   up here without copying anything, e.g.
+
+     asn1::octet_segments s;
+
+     d.decodeSegments (asn1::tOctetString, s);
+
+     for (size_t n = 0; n < s.size(); ++n)
+       write (fd, s[n].data(), s[n].size());
+
+   or, if you do want the value in one piece, coalesce() copies it with a
+   single allocation.  The first segment is stored inline, so decoding a
+   primitive string this way doesn't allocate.
+
+   For a BIT STRING, the spans exclude the initial octets, and
+   unused_bits() gives the number of unused bits in the final octet. */
+class octet_segments
+{
+private:
+  octet_span               _first;
+  std::vector<octet_span>  _rest;
+  size_t                   _count;
+  size_t                   _total;
+  unsigned                 _unused_bits;
+
+public:
+  octet_segments() : _count(0), _total(0), _unused_bits(0) {}
+
+  void clear() {
+    _rest.clear();
+    _count = _total = 0;
+    _unused_bits = 0;
+  }
+
+  void push_back(const octet_span &s) {
+    if (!_count)
+      _first = s;
+    else
+      _rest.push_back (s);
+    ++_count;
+    _total += s.size();
+  }
+
+  // The number of segments
+  size_t size() const { return _count; }
+  bool empty() const { return !_count; }
+
+  const octet_span &operator[](size_t n) const {
+    return n ? _rest[n - 1] : _first;
+  }
+
+  // The length of the complete value, in octets
+  size_t total_length() const { return _total; }
+
+  unsigned unused_bits() const { return _unused_bits; }
+  void set_unused_bits(unsigned u) { _unused_bits = u; }
+
+  /* Copy the complete value to dest, which must have room for
+     total_length() octets.  Returns a pointer just past the copy. */
+  octet *coalesce(octet *dest) const {
+    for (size_t n = 0; n < _count; ++n) {
+      const octet_span &s = (*this)[n];
+      if (s.size())
+        std::memcpy (dest, s.data(), s.size());
+      dest += s.size();
+    }
+    return dest;
+  }
+
+  // Append the complete value to a container, sizing it just once
+  template <class Container>
+  void coalesce(Container &c) const {
+    size_t pos = c.size();
+
+    c.resize (pos + _total);
+
+    typename Container::iterator out = c.begin() + pos;
+    for (size_t n = 0; n < _count; ++n) {
+      const octet_span &s = (*this)[n];
+      out = std::copy (s.begin(), s.end(), out);
+    }
+  }
+
+  /* Return a pointer to the complete value, which points into the input
+     if there is only one segment; otherwise the segments are coalesced
+     into tmp. */
+  const octet *contiguous(std::vector<octet> &tmp) const {
+    if (_count == 1)
+      return _first.data();
+    tmp.clear();
+    coalesce (tmp);
+    return tmp.data();
+  }
+};
+
+END_ASN1_NS
+
+#endif /* ASN1_SEGMENTS_H_ */
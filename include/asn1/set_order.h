@@ -0,0 +1,134 @@
+/* Emacs, this is -*-C++-*- */
+
+#ifndef ASN1_SET_ORDER_H_
+#define ASN1_SET_ORDER_H_
+
+#include "base.h"
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+BEGIN_ASN1_NS
+
+/* The elements of a DER SET or SET OF go in ascending order of their
+   encodings, compared as octet strings with the shorter padded with zero
+   octets (X.690 11.6).  Encodings are self-delimiting, so no element is a
+   proper prefix of another and "shorter first" settles any tie.
+
+   The encoders write the elements one after another into a single buffer
+   and describe each by its offset and length, so sorting moves only these
+   descriptors. */
+struct set_item {
+  size_t offset;
+  size_t length;
+};
+
+namespace detail {
+  // Compare a and b from octet depth onwards
+  inline bool set_item_less(const octet *base, const set_item &a,
+                            const set_item &b, size_t depth) {
+    size_t mlen = (a.length < b.length ? a.length : b.length) - depth;
+    int r = mlen ? std::memcmp (base + a.offset + depth,
+                                base + b.offset + depth, mlen) : 0;
+    return r < 0 || (r == 0 && a.length < b.length);
+  }
+}
+
+/* Sorts items into SET order.  This is an MSD radix sort on the
+   encodings' octets, falling back to insertion sort for small runs; SET OF
+   values with many elements usually share long prefixes (the same
+   identifier and length, say), which a radix sort gets through in one pass
+   per octet rather than re-comparing them for every pair.  The scratch
+   space is kept from one sort to the next. */
+class set_sorter
+{
+private:
+  struct run { set_item *first, *last; size_t depth; };
+
+  std::vector<set_item> _tmp;
+  std::vector<run>      _todo;
+
+public:
+  // Sort items [first, last), which describe encodings in base
+  void sort(const octet *base, set_item *first, set_item *last);
+};
+
+inline void set_sorter::sort(const octet *base, set_item *first,
+                             set_item *last)
+{
+  const size_t small = 24;
+
+  if (last - first < 2)
+    return;
+
+  _todo.clear();
+  _todo.push_back ({ first, last, 0 });
+  while (!_todo.empty()) {
+    run r = _todo.back();
+    _todo.pop_back();
+
+    size_t count = r.last - r.first;
+    if (count <= small) {
+      for (set_item *i = r.first + 1; i < r.last; ++i) {
+        set_item item = *i, *j = i;
+        for (; j > r.first
+               && detail::set_item_less (base, item, j[-1], r.depth); --j)
+          *j = j[-1];
+        *j = item;
+      }
+      continue;
+    }
+
+    // Bucket 0 is for items that end before depth; they are all equal
+    size_t counts[257] = { 0 };
+    for (set_item *i = r.first; i < r.last; ++i) {
+      unsigned k = i->length > r.depth ? 1 + base[i->offset + r.depth] : 0;
+      ++counts[k];
+    }
+
+    // If everything is in one bucket, just look at the next octet
+    unsigned full = 0;
+    while (!counts[full])
+      ++full;
+    if (counts[full] == count) {
+      if (full)
+        _todo.push_back ({ r.first, r.last, r.depth + 1 });
+      continue;
+    }
+
+    size_t starts[257];
+    size_t pos = 0;
+    for (unsigned k = 0; k < 257; ++k) {
+      starts[k] = pos;
+      pos += counts[k];
+    }
+
+    if (_tmp.size() < count)
+      _tmp.resize (count);
+    for (set_item *i = r.first; i < r.last; ++i) {
+      unsigned k = i->length > r.depth ? 1 + base[i->offset + r.depth] : 0;
+      _tmp[starts[k]++] = *i;
+    }
+    std::memcpy (r.first, _tmp.data(), count * sizeof(set_item));
+
+    // starts[k] is now the end of bucket k
+    for (unsigned k = 1; k < 257; ++k) {
+      if (counts[k] > 1) {
+        set_item *end = r.first + starts[k];
+        _todo.push_back ({ end - counts[k], end, r.depth + 1 });
+      }
+    }
+  }
+}
+
+// Sort items [first, last) into SET order, with a one-off set_sorter
+inline void sort_set_items(const octet *base, set_item *first, set_item *last)
+{
+  set_sorter s;
+  s.sort (base, first, last);
+}
+
+END_ASN1_NS
+
+#endif /* ASN1_SET_ORDER_H_ */
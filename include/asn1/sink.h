@@ -0,0 +1,72 @@
+/* Emacs, this is -*-C++-*- */
+
+#ifndef ASN1_SINK_H_
+#define ASN1_SINK_H_
+
+#include "base.h"
+
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+
+BEGIN_ASN1_NS
+
+/* Where a streaming encoder's output goes.  write() is given each run of
+   encoded octets in order, and should throw if it can't take them. */
+class sink
+{
+public:
+  virtual ~sink() {}
+  virtual void write(const octet *data, size_t len) = 0;
+};
+
+// Writes to a std::ostream, which should be in binary mode
+class ostream_sink : public sink
+{
+private:
+  std::ostream &_os;
+
+public:
+  explicit ostream_sink(std::ostream &os) : _os(os) {}
+
+  void write(const octet *data, size_t len) {
+    _os.write ((const char *)data, len);
+    if (!_os)
+      throw std::runtime_error("ostream_sink: write failed");
+  }
+};
+
+// Passes each run of octets to a function
+class callback_sink : public sink
+{
+public:
+  typedef std::function<void (const octet *, size_t)> callback;
+
+private:
+  callback _f;
+
+public:
+  explicit callback_sink(callback f) : _f(f) {}
+
+  void write(const octet *data, size_t len) { _f (data, len); }
+};
+
+/* Writes to a file descriptor, retrying short writes; it doesn't own the
+   descriptor, so won't close it */
+class fd_sink : public sink
+{
+private:
+  int _fd;
+
+public:
+  explicit fd_sink(int fd) : _fd(fd) {}
+
+  int fd() const { return _fd; }
+
+  void write(const octet *data, size_t len);
+};
+
+END_ASN1_NS
+
+#endif /* ASN1_SINK_H_ */
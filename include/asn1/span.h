@@ -0,0 +1,43 @@
+/* Emacs, this is -*-C++-*- */
+
+#ifndef ASN1_SPAN_H_
+#define ASN1_SPAN_H_
+
+#include "base.h"
+
+#include <cstddef>
+
+BEGIN_ASN1_NS
+
+/* A non-owning reference to a run of octets, usually somewhere inside the
+   buffer being decoded.  The referenced memory must outlive the span. */
+class octet_span
+{
+private:
+  const octet *_ptr;
+  size_t       _len;
+
+public:
+  typedef octet        value_type;
+  typedef const octet *iterator;
+  typedef const octet *const_iterator;
+  typedef size_t       size_type;
+
+  octet_span() : _ptr(nullptr), _len(0) {}
+  octet_span(const octet *ptr, size_t len) : _ptr(ptr), _len(len) {}
+  octet_span(const octet *ptr, const octet *end) : _ptr(ptr), _len(end - ptr) {}
+
+  const octet *data() const { return _ptr; }
+  size_t size() const { return _len; }
+  size_t length() const { return _len; }
+  bool empty() const { return !_len; }
+
+  const octet *begin() const { return _ptr; }
+  const octet *end() const { return _ptr + _len; }
+
+  octet operator[](size_t n) const { return _ptr[n]; }
+};
+
+END_ASN1_NS
+
+#endif /* ASN1_SPAN_H_ */
@@ -0,0 +1,83 @@
+/* Emacs, this is -*-C++-*- */
+
+#ifndef ASN1_STRING_VIEW_H_
+#define ASN1_STRING_VIEW_H_
+
+#include "base.h"
+#include "strings.h"
+#include "span.h"
+
+#include <cstring>
+
+BEGIN_ASN1_NS
+
+/* A non-owning view of one of the 8-bit character string types, pointing
+   straight into the buffer being decoded.  String selects the ASN.1 type
+   (and so the tag), e.g.
+
+     asn1::IA5StringView host;
+
+     d >> asn1::sequence >> host >> asn1::end;
+
+     forward (host.data(), host.size());
+
+   The view is only valid for as long as the decoded buffer is.  No check
+   is made that the octets are valid for the string type; if you need a
+   real string, use str().  Constructed encodings can't be viewed as a
+   single run of octets, so decoding one into a view fails; decode those
+   into an octet_segments instead.  (BMPString and UniversalString need their
+   octets byteswapping, so they have no views.) */
+template <class String>
+class string_view
+{
+private:
+  const char *_ptr;
+  size_t      _len;
+
+public:
+  typedef char        value_type;
+  typedef const char *iterator;
+  typedef const char *const_iterator;
+  typedef size_t      size_type;
+
+  string_view() : _ptr(nullptr), _len(0) {}
+  string_view(const char *ptr, size_t len) : _ptr(ptr), _len(len) {}
+
+  const char *data() const { return _ptr; }
+  size_t size() const { return _len; }
+  size_t length() const { return _len; }
+  bool empty() const { return !_len; }
+
+  const char *begin() const { return _ptr; }
+  const char *end() const { return _ptr + _len; }
+
+  char operator[](size_t n) const { return _ptr[n]; }
+
+  octet_span octets() const {
+    return octet_span(reinterpret_cast<const octet *>(_ptr), _len);
+  }
+
+  String str() const { return String(_ptr, _len); }
+  explicit operator String() const { return str(); }
+
+  bool operator==(const string_view &o) const {
+    return _len == o._len && (!_len || !std::memcmp (_ptr, o._ptr, _len));
+  }
+  bool operator!=(const string_view &o) const { return !(*this == o); }
+};
+
+typedef string_view<GeneralString>   GeneralStringView;
+typedef string_view<GraphicString>   GraphicStringView;
+typedef string_view<IA5String>       IA5StringView;
+typedef string_view<NumericString>   NumericStringView;
+typedef string_view<PrintableString> PrintableStringView;
+typedef string_view<T61String>       T61StringView;
+typedef T61StringView                TeletexStringView;
+typedef string_view<UTF8String>      UTF8StringView;
+typedef string_view<VideotexString>  VideotexStringView;
+typedef string_view<VisibleString>   VisibleStringView;
+typedef VisibleStringView            ISO646StringView;
+
+END_ASN1_NS
+
+#endif /* ASN1_STRING_VIEW_H_ */
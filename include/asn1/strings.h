@@ -7,6 +7,7 @@
 #include "base.h"
 
 #include <string>
+#include <stdexcept>
 
 BEGIN_ASN1_NS
 
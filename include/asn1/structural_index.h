@@ -0,0 +1,197 @@
+/* Emacs, this is -*-C++-*- */
+
+#ifndef ASN1_STRUCTURAL_INDEX_H_
+#define ASN1_STRUCTURAL_INDEX_H_
+
+#include "base.h"
+#include "Tag.h"
+#include "span.h"
+#include "ber_view.h"
+
+#include <stdexcept>
+#include <vector>
+
+BEGIN_ASN1_NS
+
+/* A flat index of every TLV in a (typically very large) BER document,
+   e.g. a multi-megabyte CRL or a SEQUENCE OF with millions of entries.
+
+   Building the index validates every tag and length header in a single
+   pass, without recursion, and records each element's offset, depth and
+   tag in document order.  Once built, the index can be navigated and
+   the contents of any element fetched without any further checks, e.g.
+
+     asn1::structural_index idx(data, len);
+
+     for (size_t n = idx.first_child(0); n != idx.npos;
+          n = idx.next_sibling(n)) {
+       if (idx[n].tag == asn1::tInteger)
+         ...idx.value(n)...
+     }
+
+   BER headers form a serial dependency chain (each length tells us where
+   the next header is), so the pass can't be vectorised the way a JSON
+   structural scan can; instead, the common single-octet tag/short-form
+   length case is handled with a single bounds check and no loops, and
+   only the rare long forms fall back to the general parser. */
+class structural_index
+{
+public:
+  static const size_t npos = ~static_cast<size_t>(0);
+
+  struct entry {
+    size_t   offset;         // Of the identifier octets
+    size_t   length;         // Of the contents, excluding any EOC
+    size_t   next;           // Index of the next sibling, or npos
+    Tag      tag;
+    uint32   depth;
+    uint8    header_length;
+    bool     constructed;
+    bool     indefinite;
+  };
+
+private:
+  struct State {
+    size_t       index;      // Of the constructed entry
+    const octet *end;        // End of its contents, or NULL if indefinite
+    const octet *limit;      // End of the nearest definite value
+    size_t       last;       // Last child seen so far, or npos
+  };
+
+  const octet        *_data;
+  size_t              _size;
+  std::vector<entry>  _entries;
+
+public:
+  structural_index() : _data(nullptr), _size(0) {}
+  structural_index(const octet *data, size_t len) { build (data, len); }
+
+  void build(const octet *data, size_t len) {
+    const octet *ptr = data;
+    const octet *end = data + len;
+    std::vector<State> stack;
+    size_t last = npos;
+
+    _data = data;
+    _size = len;
+    _entries.clear();
+
+    for (;;) {
+      const octet *limit = end;
+
+      if (!stack.empty()) {
+        State &s = stack.back();
+
+        if (s.end && ptr == s.end) {
+          // Finished a definite length value
+          stack.pop_back();
+          continue;
+        }
+
+        limit = s.limit;
+
+        if (!s.end && ptr < limit && !*ptr) {
+          // Finished an indefinite length value
+          if (limit - ptr < 2 || ptr[1])
+            throw std::runtime_error("bad length on End of Contents tag");
+
+          entry &e = _entries[s.index];
+          e.length = ptr - (_data + e.offset + e.header_length);
+          ptr += 2;
+          stack.pop_back();
+          continue;
+        }
+
+        if (ptr >= limit)
+          throw std::runtime_error(s.end ? "out of bounds"
+                                   : "missing End of Contents");
+      } else if (ptr >= end) {
+        break;
+      }
+
+      entry e;
+
+      e.offset = ptr - data;
+      e.next = npos;
+      e.depth = stack.size();
+
+      octet t = *ptr;
+
+      if (limit - ptr >= 2 && (t & 0x1f) != 0x1f && ptr[1] < 0x80) {
+        // Fast path: one octet of tag, short form length
+        e.tag = Tag((TagClass)(t >> 6), t & 0x1f);
+        e.constructed = t & 0x20;
+        e.indefinite = false;
+        e.header_length = 2;
+        e.length = ptr[1];
+
+        if (e.length > static_cast<size_t>(limit - ptr - 2))
+          throw std::runtime_error("out of bounds");
+      } else {
+        ber_view v(ptr, limit - ptr);
+
+        e.tag = v.tag();
+        e.constructed = v.constructed();
+        e.indefinite = v.indefinite();
+        e.header_length = v.header_length();
+        e.length = e.indefinite ? 0 : v.value().size();
+      }
+
+      size_t index = _entries.size();
+      size_t &prev = stack.empty() ? last : stack.back().last;
+
+      if (prev != npos)
+        _entries[prev].next = index;
+      prev = index;
+
+      _entries.push_back(e);
+
+      ptr += e.header_length;
+
+      if (e.constructed) {
+        State s;
+
+        s.index = index;
+        s.end = e.indefinite ? NULL : ptr + e.length;
+        s.limit = e.indefinite ? limit : s.end;
+        s.last = npos;
+
+        stack.push_back(s);
+      } else {
+        ptr += e.length;
+      }
+    }
+  }
+
+  size_t size() const { return _entries.size(); }
+  bool empty() const { return _entries.empty(); }
+  const entry &operator[](size_t n) const { return _entries[n]; }
+
+  const entry *begin() const { return _entries.data(); }
+  const entry *end() const { return _entries.data() + _entries.size(); }
+
+  size_t first_child(size_t n) const {
+    if (!_entries[n].constructed || n + 1 >= _entries.size()
+        || _entries[n + 1].depth <= _entries[n].depth)
+      return npos;
+    return n + 1;
+  }
+  size_t next_sibling(size_t n) const { return _entries[n].next; }
+
+  // The contents octets (excluding any End of Contents)
+  octet_span value(size_t n) const {
+    const entry &e = _entries[n];
+    return octet_span(_data + e.offset + e.header_length, e.length);
+  }
+
+  // The complete encoding, including any End of Contents
+  octet_span encoding(size_t n) const {
+    const entry &e = _entries[n];
+    return octet_span(_data + e.offset,
+                      e.header_length + e.length + (e.indefinite ? 2 : 0));
+  }
+};
+
+END_ASN1_NS
+
+#endif /* ASN1_STRUCTURAL_INDEX_H_ */
@@ -0,0 +1,32 @@
+#include <asn1/sink.h>
+
+#include <unistd.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <cerrno>
+
+using namespace asn1;
+
+void
+fd_sink::write (const octet *data, size_t len)
+{
+  while (len) {
+    ssize_t done = ::write (_fd, data, len);
+
+    if (done < 0) {
+      if (errno == EINTR)
+        continue;
+
+      int err = errno;
+      char buffer[256];
+      strerror_r (err, buffer, sizeof (buffer));
+      throw std::runtime_error(std::string("fd_sink: write: ")
+                               + std::to_string(err) + " - " + buffer);
+    }
+
+    data += done;
+    len -= done;
+  }
+}
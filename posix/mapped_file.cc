@@ -0,0 +1,79 @@
+#include <asn1/mapped_file.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <cerrno>
+
+using namespace asn1;
+
+static void
+throw_errno (const char *what, int err)
+{
+  char buffer[256];
+  strerror_r (err, buffer, sizeof (buffer));
+  throw std::runtime_error(std::string("mapped_file: ") + what + ": "
+                           + std::to_string(err) + " - " + buffer);
+}
+
+void
+mapped_file::map (const std::string &path, AccessPattern pattern)
+{
+  int fd = open (path.c_str(), O_RDONLY);
+
+  if (fd < 0)
+    throw_errno ("open", errno);
+
+  struct stat st;
+
+  if (fstat (fd, &st) < 0) {
+    int err = errno;
+    close (fd);
+    throw_errno ("fstat", err);
+  }
+
+  if (static_cast<unsigned long long>(st.st_size)
+      > static_cast<size_t>(-1)) {
+    close (fd);
+    throw std::runtime_error("mapped_file: file too large to map");
+  }
+
+  _size = st.st_size;
+
+  // mmap() won't map an empty file, but there's nothing to decode anyway
+  if (!_size) {
+    close (fd);
+    return;
+  }
+
+  void *ptr = mmap (NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (ptr == MAP_FAILED) {
+    int err = errno;
+    close (fd);
+    _size = 0;
+    throw_errno ("mmap", err);
+  }
+
+  // The mapping keeps the file open for us
+  close (fd);
+
+  madvise (ptr, _size,
+           pattern == SEQUENTIAL ? MADV_SEQUENTIAL : MADV_RANDOM);
+
+  _data = (const octet *)ptr;
+}
+
+void
+mapped_file::unmap ()
+{
+  if (_data)
+    munmap ((void *)_data, _size);
+  _data = nullptr;
+  _size = 0;
+}
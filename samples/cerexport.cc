@@ -0,0 +1,95 @@
+// Streams a large SEQUENCE OF records to a file as CER, then reads it back
+// a chunk at a time with BERStreamDecoder; neither side ever holds more
+// than a few kilobytes of it
+#include <asn1/asn1.h>
+#include <asn1/BERStreamDecoder.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+namespace {
+
+const unsigned count = 1000000;
+
+class counter : public asn1::BERStreamDecoder::handler {
+public:
+  unsigned records, integers, segments;
+  size_t   payload;
+
+  counter() : records(0), integers(0), segments(0), payload(0) {}
+
+  void beginConstructed (asn1::Tag t, bool, size_t) {
+    if (t == asn1::tSequence)
+      ++records;
+  }
+  void endConstructed (asn1::Tag) {}
+  void primitive (asn1::Tag t, const asn1::octet *, size_t len) {
+    if (t == asn1::tInteger)
+      ++integers;
+    else if (t == asn1::tOctetString) {
+      ++segments;
+      payload += len;
+    }
+  }
+};
+
+}
+
+int main (void)
+{
+  char path[] = "/tmp/cerexportXXXXXX";
+  int fd = mkstemp (path);
+
+  if (fd < 0) {
+    std::perror ("mkstemp");
+    return 1;
+  }
+
+  // Every hundredth record carries a payload big enough to be segmented
+  std::vector<asn1::octet> payload (4500, 0xa5);
+
+  {
+    asn1::fd_sink out (fd);
+    asn1::CERStreamEncoder e (out, 4096);
+
+    e << asn1::sequence;
+    for (unsigned n = 0; n < count; ++n) {
+      e << asn1::sequence
+        << asn1::int32 (n)
+        << asn1::PrintableString ("record")
+        << asn1::octet_ref (payload.data(), n % 100 ? 0 : payload.size())
+        << asn1::end;
+    }
+    e << asn1::end;
+    e.flush ();
+  }
+
+  lseek (fd, 0, SEEK_SET);
+
+  counter c;
+  asn1::BERStreamDecoder d (c);
+  asn1::octet chunk[4096];
+  ssize_t got;
+  size_t total = 0;
+  bool complete = false;
+
+  while ((got = read (fd, chunk, sizeof (chunk))) > 0) {
+    size_t consumed;
+    total += got;
+    if (d.feed (chunk, got, consumed) == asn1::BERStreamDecoder::COMPLETE)
+      complete = true;
+  }
+
+  close (fd);
+  unlink (path);
+
+  std::cout << total << " octets, " << c.records - 1 << " records, "
+            << c.segments << " OCTET STRING segments holding " << c.payload
+            << " octets" << std::endl;
+
+  return complete && c.records == count + 1 && c.integers == count ? 0 : 1;
+}
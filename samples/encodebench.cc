@@ -0,0 +1,181 @@
+// Compares three ways of DER encoding the same structure: the usual
+// DEREncoder, which builds every SEQUENCE in its own buffer and copies it
+// into its parent; encodeTwoPass(), which sizes the structure first and
+// then writes it straight into the output; and DERBackEncoder, which
+// writes it back to front into a single buffer.  It does so for something
+// the shape of a certificate and for a deep chain of SEQUENCEs
+#include <asn1/asn1.h>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+const unsigned rounds = 20000;
+
+// Roughly the shape of an X.509 certificate: a few levels of SEQUENCEs,
+// a list of names, some extensions and a public key
+void certificate (asn1::DEREncoder &e, const std::vector<asn1::octet> &key)
+{
+  const asn1::octet sig[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+
+  e << asn1::sequence                               // Certificate
+    << asn1::sequence                               // TBSCertificate
+    << asn1::int64 (0x1234567890ll);                // serialNumber
+  for (unsigned name = 0; name < 2; ++name) {       // issuer, subject
+    e << asn1::sequence;
+    for (unsigned rdn = 0; rdn < 6; ++rdn)
+      e << asn1::sequence << asn1::sequence
+        << asn1::int32 (rdn) << asn1::PrintableString ("Example Name")
+        << asn1::end << asn1::end;
+    e << asn1::end;
+  }
+  e << asn1::sequence                               // subjectPublicKeyInfo
+    << asn1::sequence << asn1::int32 (1) << asn1::end
+    << key
+    << asn1::end;
+  e << asn1::sequence;                              // extensions
+  for (unsigned ext = 0; ext < 8; ++ext)
+    e << asn1::sequence << asn1::int32 (ext) << true
+      << std::vector<asn1::octet> (sig, sig + sizeof (sig))
+      << asn1::end;
+  e << asn1::end
+    << asn1::end                                    // TBSCertificate
+    << asn1::sequence << asn1::int32 (2) << asn1::end
+    << std::vector<asn1::octet> (sig, sig + sizeof (sig))
+    << asn1::end;
+}
+
+// The same, mirrored for DERBackEncoder
+void certificate (asn1::DERBackEncoder &e, const std::vector<asn1::octet> &key)
+{
+  const asn1::octet sig[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+
+  e << asn1::end
+    << std::vector<asn1::octet> (sig, sig + sizeof (sig))
+    << asn1::end << asn1::int32 (2) << asn1::sequence
+    << asn1::end;                                   // TBSCertificate
+  e << asn1::end;                                   // extensions
+  for (unsigned ext = 8; ext-- > 0; )
+    e << asn1::end
+      << std::vector<asn1::octet> (sig, sig + sizeof (sig))
+      << true << asn1::int32 (ext)
+      << asn1::sequence;
+  e << asn1::sequence;
+  e << asn1::end                                    // subjectPublicKeyInfo
+    << key
+    << asn1::end << asn1::int32 (1) << asn1::sequence
+    << asn1::sequence;
+  for (unsigned name = 0; name < 2; ++name) {       // subject, issuer
+    e << asn1::end;
+    for (unsigned rdn = 6; rdn-- > 0; )
+      e << asn1::end << asn1::end
+        << asn1::PrintableString ("Example Name") << asn1::int32 (rdn)
+        << asn1::sequence << asn1::sequence;
+    e << asn1::sequence;
+  }
+  e << asn1::int64 (0x1234567890ll)                 // serialNumber
+    << asn1::sequence                               // TBSCertificate
+    << asn1::sequence;                              // Certificate
+}
+
+// A chain of SEQUENCEs, each holding a small value and the next one,
+// with a larger value at the bottom; nested buffers copy that value once
+// per level on the way out
+const unsigned depth = 32;
+
+void deep (asn1::DEREncoder &e, const std::vector<asn1::octet> &leaf)
+{
+  for (unsigned level = 0; level < depth; ++level)
+    e << asn1::sequence << asn1::int32 (level);
+  e << leaf;
+  for (unsigned level = 0; level < depth; ++level)
+    e << asn1::end;
+}
+
+void deep (asn1::DERBackEncoder &e, const std::vector<asn1::octet> &leaf)
+{
+  for (unsigned level = 0; level < depth; ++level)
+    e << asn1::end;
+  e << leaf;
+  for (unsigned level = depth; level-- > 0; )
+    e << asn1::int32 (level) << asn1::sequence;
+}
+
+template <class F>
+double time_us (F f)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned n = 0; n < rounds; ++n)
+    f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(end - start).count()
+    / rounds;
+}
+
+// Time the three encoders on one structure; false if they disagree
+template <class F, class G>
+bool compare (const char *what, F forwards, G backwards, size_t &sum)
+{
+  double nested = time_us ([&] {
+      asn1::DEREncoder e;
+      forwards (e);
+      sum += e.asDER().length();
+    });
+
+  double twopass = time_us ([&] {
+      asn1::DEREncoder e;
+      e.encodeTwoPass (forwards);
+      sum += e.asDER().length();
+    });
+
+  double reversed = time_us ([&] {
+      asn1::DERBackEncoder e;
+      backwards (e);
+      sum += e.asDER().length();
+    });
+
+  // All must produce the same encoding
+  asn1::DEREncoder a, b;
+  asn1::DERBackEncoder c;
+  forwards (a);
+  b.encodeTwoPass (forwards);
+  backwards (c);
+  if (a.asDER().length() != b.asDER().length()
+      || a.asDER().length() != c.asDER().length()
+      || std::memcmp (a.asDER().data(), b.asDER().data(),
+                      a.asDER().length()) != 0
+      || std::memcmp (a.asDER().data(), c.asDER().data(),
+                      a.asDER().length()) != 0) {
+    std::cerr << what << ": encodings differ" << std::endl;
+    return false;
+  }
+
+  std::cout << what << ", " << a.asDER().length()
+            << " octets: nested buffers " << nested
+            << " us, two-pass " << twopass << " us, back to front "
+            << reversed << " us" << std::endl;
+  return true;
+}
+
+}
+
+int main (void)
+{
+  std::vector<asn1::octet> key (256, 0x5a);
+  std::vector<asn1::octet> leaf (4096, 0xa5);
+  size_t sum = 0;
+
+  bool ok = compare ("certificate",
+                     [&] (asn1::DEREncoder &e) { certificate (e, key); },
+                     [&] (asn1::DERBackEncoder &e) { certificate (e, key); },
+                     sum)
+    && compare ("32 levels deep",
+                [&] (asn1::DEREncoder &e) { deep (e, leaf); },
+                [&] (asn1::DERBackEncoder &e) { deep (e, leaf); },
+                sum);
+
+  // Stop the compiler discarding the work
+  return !ok || sum == 0;
+}
@@ -0,0 +1,91 @@
+// Compares decoding and encoding element headers (identifier and length)
+// one octet at a time with the fused expectHeader()/encodeHeader() path
+#include <asn1/asn1.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+const unsigned count = 1000000;
+const unsigned rounds = 20;
+
+template <class F>
+double time_ns (F f)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned n = 0; n < rounds; ++n)
+    f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count()
+    / (double(rounds) * count);
+}
+
+}
+
+int main (void)
+{
+  // A SEQUENCE OF INTEGER, all short, so every header is two octets
+  asn1::DEREncoder e;
+  e << asn1::sequence;
+  for (unsigned n = 0; n < count; ++n)
+    e << asn1::int32 ((n & 0x7f) | 1);
+  e << asn1::end;
+
+  const asn1::DEREncoder::buffer &der = e.asDER();
+  asn1::uint64 sum = 0;
+
+  double split = time_ns ([&] {
+      asn1::BERDecoder d (der.data(), der.length());
+      d >> asn1::sequence;
+      while (!d.atEnd()) {
+        d.expectTag (asn1::tInteger);
+        size_t len = d.decodeLength();
+        sum += *d.getOctets (len);
+      }
+      d >> asn1::end;
+    });
+
+  double fused = time_ns ([&] {
+      asn1::BERDecoder d (der.data(), der.length());
+      d >> asn1::sequence;
+      while (!d.atEnd()) {
+        size_t len = d.expectHeader (asn1::tInteger);
+        sum += *d.getOctets (len);
+      }
+      d >> asn1::end;
+    });
+
+  std::cout << "decode: expectTag+decodeLength " << split << " ns/element, "
+            << "expectHeader " << fused << " ns/element" << std::endl;
+
+  const asn1::octet value = 0x2a;
+
+  double split_enc = time_ns ([&] {
+      asn1::DEREncoder::buffer b;
+      asn1::DEREncoder o (b);
+      for (unsigned n = 0; n < count; ++n) {
+        o.encodeTag (asn1::tInteger);
+        o.encodeLength (1);
+        o.encodeOctet (value);
+      }
+      sum += b.length();
+    });
+
+  double fused_enc = time_ns ([&] {
+      asn1::DEREncoder::buffer b;
+      asn1::DEREncoder o (b);
+      for (unsigned n = 0; n < count; ++n) {
+        o.encodeHeader (asn1::tInteger, 1);
+        o.encodeOctet (value);
+      }
+      sum += b.length();
+    });
+
+  std::cout << "encode: encodeTag+encodeLength " << split_enc
+            << " ns/element, encodeHeader " << fused_enc << " ns/element"
+            << std::endl;
+
+  // Stop the compiler discarding the work
+  return sum == 0;
+}
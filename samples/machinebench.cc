@@ -0,0 +1,92 @@
+// Times the bit operations in machine.h and the DER INTEGER and REAL
+// encoders that sit on top of them.  Build it twice, once as usual and
+// once with -DASN1_NO_BUILTINS, to compare the compiler builtins with the
+// portable fallbacks; adding -march=native (or -mlzcnt -mbmi -mpopcnt)
+// lets the builtins use lzcnt, tzcnt and popcnt.
+#include <asn1/asn1.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+const unsigned count = 1 << 16;
+const unsigned rounds = 200;
+
+template <class F>
+double time_ns (F f)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned n = 0; n < rounds; ++n)
+    f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count()
+    / (double(rounds) * count);
+}
+
+void report (const char *what, double ns)
+{
+  std::cout << "  " << what << ns << " ns" << std::endl;
+}
+
+}
+
+int main (void)
+{
+  // Values of every magnitude, so that the lengths vary
+  std::vector<asn1::uint64> words (count);
+  std::vector<asn1::int64>  integers (count);
+  std::vector<double>       reals (count);
+  asn1::uint64 x = 0x9e3779b97f4a7c15ull;
+
+  for (unsigned n = 0; n < count; ++n) {
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    words[n] = x >> (n % 64);
+    integers[n] = static_cast<asn1::int64>(x) >> (n % 64);
+    reals[n] = static_cast<double>(integers[n]) / ((n % 1000) + 1);
+  }
+
+  asn1::uint64 sum = 0;
+  asn1::DEREncoder e;
+
+  std::cout <<
+#if defined(ASN1_NO_BUILTINS)
+    "portable fallbacks"
+#else
+    "compiler builtins"
+#endif
+    << ", " << (asn1::machine::is_big_endian() ? "big" : "little")
+    << " endian" << std::endl;
+
+  report ("clz:            ", time_ns ([&] {
+        for (unsigned n = 0; n < count; ++n)
+          sum += asn1::machine::clz (words[n]);
+      }));
+  report ("ctz:            ", time_ns ([&] {
+        for (unsigned n = 0; n < count; ++n)
+          sum += asn1::machine::ctz (words[n]);
+      }));
+  report ("pop:            ", time_ns ([&] {
+        for (unsigned n = 0; n < count; ++n)
+          sum += asn1::machine::pop (words[n]);
+      }));
+  report ("to_be:          ", time_ns ([&] {
+        for (unsigned n = 0; n < count; ++n)
+          sum += asn1::machine::to_be (words[n]);
+      }));
+  report ("INTEGER encode: ", time_ns ([&] {
+        e.reset ();
+        for (unsigned n = 0; n < count; ++n)
+          e << integers[n];
+        sum += e.asDER().length();
+      }));
+  report ("REAL encode:    ", time_ns ([&] {
+        e.reset ();
+        for (unsigned n = 0; n < count; ++n)
+          e << reals[n];
+        sum += e.asDER().length();
+      }));
+
+  // Stop the compiler discarding the work
+  return sum == 0;
+}
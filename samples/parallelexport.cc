@@ -0,0 +1,112 @@
+// Encodes a large SEQUENCE OF records once with a single DEREncoder and
+// once with parallel_sequence_of, checks that the two agree, and writes
+// the parallel one to a file with writev() without copying it together
+#include <asn1/asn1.h>
+#include <asn1/parallel.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+const unsigned count = 1000000;
+
+struct record {
+  asn1::int32 id;
+  asn1::int64 timestamp;
+  bool        valid;
+};
+
+void put (asn1::DEREncoder &e, const record &r)
+{
+  e << asn1::sequence
+    << r.id << r.timestamp << r.valid << asn1::PrintableString ("record")
+    << asn1::end;
+}
+
+double elapsed (std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>
+    (std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+int main (void)
+{
+  std::vector<record> records (count);
+
+  for (unsigned n = 0; n < count; ++n) {
+    records[n].id = n;
+    records[n].timestamp = 1500000000000ll + n * 1000ll;
+    records[n].valid = n % 3 != 0;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  asn1::DEREncoder single;
+  single.encodeTwoPass ([&] (asn1::DEREncoder &e) {
+      e << asn1::sequence;
+      for (auto r = records.begin(); r < records.end(); ++r)
+        put (e, *r);
+      e << asn1::end;
+    });
+  double single_ms = elapsed (start);
+
+  asn1::parallel_sequence_of p;
+  asn1::DEREncoder e;
+
+  start = std::chrono::steady_clock::now();
+  p.encode (records.begin(), records.end(), put);
+  e << p;
+  double parallel_ms = elapsed (start);
+
+  std::vector<struct iovec> iov;
+  e.gather (iov);
+
+  // Check the stitched result against the single-threaded one
+  const asn1::octet *expect = single.asDER().data();
+  size_t pos = 0;
+  bool same = e.encodedLength() == single.asDER().length();
+  for (auto v = iov.begin(); same && v < iov.end(); ++v) {
+    same = std::memcmp (expect + pos, v->iov_base, v->iov_len) == 0;
+    pos += v->iov_len;
+  }
+
+  char path[] = "/tmp/parallelexportXXXXXX";
+  int fd = mkstemp (path);
+
+  if (fd < 0) {
+    std::perror ("mkstemp");
+    return 1;
+  }
+
+  start = std::chrono::steady_clock::now();
+  for (size_t n = 0; n < iov.size(); n += IOV_MAX) {
+    int batch = iov.size() - n < IOV_MAX ? iov.size() - n : IOV_MAX;
+    if (writev (fd, &iov[n], batch) < 0) {
+      std::perror ("writev");
+      return 1;
+    }
+  }
+  double write_ms = elapsed (start);
+
+  close (fd);
+  unlink (path);
+
+  std::cout << count << " records, " << e.encodedLength() << " octets in "
+            << p.runs().size() << " runs" << std::endl
+            << "single encoder:   " << single_ms << " ms" << std::endl
+            << "parallel:         " << parallel_ms << " ms on "
+            << std::thread::hardware_concurrency() << " threads" << std::endl
+            << "writev:           " << write_ms << " ms" << std::endl;
+
+  return same ? 0 : 1;
+}
@@ -0,0 +1,63 @@
+// Round-trips a value through the codecs tools/asn1c.py generates from
+// telemetry.asn1
+#include <asn1/asn1.h>
+#include <telemetry.h>
+#include <iostream>
+
+int main (void)
+{
+  Telemetry::Report r;
+
+  r.source.which = Telemetry::Source::NAME;
+  r.source.name = u"weather-station-7";
+  r.sequence = 3000000000u;
+  r.samples = { 0, 1, -1, 127, 128, -129, 1234567890123ll };
+  const asn1::octet flags = 0x40;
+  r.flags.assign (&flags, 2);
+  r.note = asn1::IA5String (u"roof");
+
+  Telemetry::Reading reading;
+  reading.sensor = 12;
+  reading.value = -40;
+  r.readings.push_back (reading);
+  reading.sensor = 13;
+  reading.value = 100;
+  reading.valid = false;
+  reading.severity = Telemetry::Severity_warning;
+  r.readings.push_back (reading);
+
+  asn1::DEREncoder e;
+  e << r;
+
+  const asn1::DEREncoder::buffer &der = e.asDER();
+  std::cout << der;
+
+  asn1::BERDecoder d (der.data(), der.length());
+  Telemetry::Report r2;
+  d >> r2;
+
+  // Encoding the decoded value must give back the same octets
+  asn1::DEREncoder e2;
+  e2 << r2;
+
+  bool ok = (e2.asDER() == der
+             && r2.source.which == Telemetry::Source::NAME
+             && r2.source.name == r.source.name
+             && r2.sequence == r.sequence
+             && r2.samples == r.samples
+             && r2.flags.size() == 2
+             && !r2.location.present()
+             && r2.note.present() && *r2.note == *r.note
+             && !r2.labels.present()
+             && r2.readings.size() == 2
+             && r2.readings[0].valid
+             && r2.readings[0].severity == Telemetry::Severity_info
+             && r2.readings[1].sensor == 13
+             && r2.readings[1].value == 100
+             && !r2.readings[1].valid
+             && r2.readings[1].severity == Telemetry::Severity_warning);
+
+  std::cout << (ok ? "round trip OK" : "round trip FAILED") << std::endl;
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,206 @@
+#include <asn1/BERStreamDecoder.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+void
+asn1::BERStreamDecoder::reset()
+{
+  _phase = TAG;
+  _offset = 0;
+  _stack.clear();
+  _pending.clear();
+}
+
+void
+asn1::BERStreamDecoder::checkHeaderOctet()
+{
+  if (_offset >= limit())
+    throw std::runtime_error("out of bounds");
+}
+
+void
+asn1::BERStreamDecoder::headerDone()
+{
+  Tag t(_tag_class, _number);
+
+  if (!_indefinite && _length > limit() - _offset)
+    throw std::runtime_error("out of bounds");
+
+  if (_constructed) {
+    _stack.push_back(State(t, _indefinite,
+                           _indefinite ? limit() : _offset + _length));
+    _handler.beginConstructed (t, _indefinite, _length);
+
+    if (!_indefinite && !_length)
+      elementDone();
+    else
+      _phase = TAG;
+  } else if (!_length) {
+    _handler.primitive (t, nullptr, 0);
+    elementDone();
+  } else {
+    _phase = CONTENTS;
+  }
+}
+
+// Close any definite length values that end here
+void
+asn1::BERStreamDecoder::elementDone()
+{
+  while (!_stack.empty()) {
+    State &s = _stack.back();
+
+    if (s.indefinite || _offset < s.end)
+      break;
+
+    _handler.endConstructed (s.tag);
+    _stack.pop_back();
+  }
+
+  _phase = _stack.empty() ? DONE : TAG;
+}
+
+asn1::BERStreamDecoder::status
+asn1::BERStreamDecoder::feed(const octet *data, size_t len, size_t &consumed)
+{
+  const octet *p = data;
+  const octet *end = data + len;
+
+  while (p < end) {
+    switch (_phase) {
+    case TAG:
+      {
+        checkHeaderOctet();
+
+        octet t = *p++;
+        ++_offset;
+
+        if (!t && !_stack.empty() && _stack.back().indefinite) {
+          _phase = END_OF_CONTENTS;
+          break;
+        }
+
+        _tag_class = (TagClass)(t >> 6);
+        _constructed = t & 0x20;
+
+        if ((t & 0x1f) == 0x1f) {
+          _number = 0;
+          _count = 0;
+          _phase = TAG_NUMBER;
+        } else {
+          _number = t & 0x1f;
+          _phase = LENGTH;
+        }
+      }
+      break;
+
+    case TAG_NUMBER:
+      {
+        checkHeaderOctet();
+
+        octet o = *p++;
+        ++_offset;
+
+        if (++_count > 4)
+          throw std::runtime_error("bad TBF value");
+
+        _number = (_number << 7) | (o & 0x7f);
+        if (!(o & 0x80))
+          _phase = LENGTH;
+      }
+      break;
+
+    case LENGTH:
+      {
+        checkHeaderOctet();
+
+        octet l = *p++;
+        ++_offset;
+
+        _length = 0;
+        _indefinite = false;
+
+        if (l == 0x80) {
+          if (!_constructed)
+            throw std::runtime_error("indefinite length on primitive value");
+          _indefinite = true;
+          headerDone();
+        } else if (l < 0x80) {
+          _length = l;
+          headerDone();
+        } else {
+          _count = l & 0x7f;
+          if (_count > sizeof(size_t) || l == 0xff)
+            throw std::runtime_error("bad length value");
+          _phase = LENGTH_MORE;
+        }
+      }
+      break;
+
+    case LENGTH_MORE:
+      checkHeaderOctet();
+
+      _length = (_length << 8) | *p++;
+      ++_offset;
+
+      if (!--_count)
+        headerDone();
+      break;
+
+    case CONTENTS:
+      {
+        size_t avail = end - p;
+        Tag t(_tag_class, _number);
+
+        if (_pending.empty() && avail >= _length) {
+          // The whole value is in this chunk, so don't copy it
+          _handler.primitive (t, p, _length);
+          p += _length;
+          _offset += _length;
+          elementDone();
+        } else {
+          size_t n = std::min(avail, _length - _pending.size());
+
+          _pending.insert (_pending.end(), p, p + n);
+          p += n;
+          _offset += n;
+
+          if (_pending.size() == _length) {
+            _handler.primitive (t, _pending.data(), _length);
+            _pending.clear();
+            elementDone();
+          }
+        }
+      }
+      break;
+
+    case END_OF_CONTENTS:
+      if (*p++)
+        throw std::runtime_error("bad length on End of Contents tag");
+      ++_offset;
+
+      _handler.endConstructed (_stack.back().tag);
+      _stack.pop_back();
+
+      if (!_stack.empty() && _offset > _stack.back().end)
+        throw std::runtime_error("out of bounds");
+
+      elementDone();
+      break;
+
+    case DONE:
+      break;
+    }
+
+    if (_phase == DONE) {
+      consumed = p - data;
+      _phase = TAG;
+      _offset = 0;
+      return COMPLETE;
+    }
+  }
+
+  consumed = len;
+  return NEED_MORE_DATA;
+}
@@ -0,0 +1,1192 @@
+#!/usr/bin/env python3
+#
+# asn1c.py - compile ASN.1 modules to C++ codecs for libasn1
+#
+# Reads one ASN.1 module and writes a header declaring a C++ type for
+# each type assignment, and a source file containing straight-line DER
+# encoders and BER decoders built on asn1::DEREncoder and asn1::BERDecoder:
+#
+#   asn1c.py [-o outdir] module.asn1
+#
+# produces outdir/module.h and outdir/module.cc.  The C++ types live in a
+# namespace named after the module.
+#
+# Supported: BOOLEAN, INTEGER (a value range picks the C++ type),
+# ENUMERATED, NULL, REAL, OCTET STRING, BIT STRING, OBJECT IDENTIFIER,
+# RELATIVE-OID, the character string types, SEQUENCE, SET, SEQUENCE OF,
+# SET OF and CHOICE, with tags, OPTIONAL, DEFAULT, extension markers and
+# EXPLICIT, IMPLICIT or AUTOMATIC tagging, plus INTEGER and BOOLEAN value
+# assignments.  Constraints other than INTEGER value ranges are ignored.
+# IMPORTS, parameterized types and information objects are not.
+
+import os
+import re
+import sys
+import argparse
+
+class CompileError(Exception):
+    pass
+
+# ----------------------------------------------------------------------
+# Lexer
+
+TOKEN_RE = re.compile(r'''
+    (?P<ws>\s+)
+  | (?P<comment>--(?:[^-\n]|-(?!-))*(?:--|$))
+  | (?P<block>/\*.*?\*/)
+  | (?P<assign>::=)
+  | (?P<ellipsis>\.\.\.)
+  | (?P<range>\.\.)
+  | (?P<number>-?\d+)
+  | (?P<string>"(?:[^"]|"")*")
+  | (?P<word>[A-Za-z][A-Za-z0-9]*(?:-[A-Za-z0-9]+)*)
+  | (?P<punct>[{}()\[\],;|<.@!^:])
+''', re.VERBOSE | re.MULTILINE | re.DOTALL)
+
+class Token(object):
+    def __init__(self, kind, text, line):
+        self.kind = kind
+        self.text = text
+        self.line = line
+
+    def __repr__(self):
+        return '%s %r' % (self.kind, self.text)
+
+def tokenize(text):
+    tokens = []
+    pos = 0
+    line = 1
+    while pos < len(text):
+        m = TOKEN_RE.match(text, pos)
+        if not m:
+            raise CompileError('line %d: unexpected character %r'
+                               % (line, text[pos]))
+        kind = m.lastgroup
+        if kind not in ('ws', 'comment', 'block'):
+            tokens.append(Token(kind, m.group(kind), line))
+        line += m.group(0).count('\n')
+        pos = m.end()
+    tokens.append(Token('eof', '', line))
+    return tokens
+
+# ----------------------------------------------------------------------
+# Abstract syntax
+
+STRING_TYPES = {
+    'BMPString': ('asn1::BMPString', 30),
+    'GeneralString': ('asn1::GeneralString', 27),
+    'GraphicString': ('asn1::GraphicString', 25),
+    'IA5String': ('asn1::IA5String', 22),
+    'ISO646String': ('asn1::ISO646String', 26),
+    'NumericString': ('asn1::NumericString', 18),
+    'PrintableString': ('asn1::PrintableString', 19),
+    'T61String': ('asn1::T61String', 20),
+    'TeletexString': ('asn1::TeletexString', 20),
+    'UniversalString': ('asn1::UniversalString', 28),
+    'UTF8String': ('asn1::UTF8String', 12),
+    'VideotexString': ('asn1::VideotexString', 21),
+    'VisibleString': ('asn1::VisibleString', 26),
+}
+
+UNIVERSAL_NUMBERS = {
+    'BOOLEAN': 1, 'INTEGER': 2, 'BIT STRING': 3, 'OCTET STRING': 4,
+    'NULL': 5, 'OBJECT IDENTIFIER': 6, 'REAL': 9, 'ENUMERATED': 10,
+    'RELATIVE-OID': 13, 'SEQUENCE': 16, 'SEQUENCE OF': 16, 'SET': 17,
+    'SET OF': 17,
+}
+
+CONSTRUCTED_KINDS = ('SEQUENCE', 'SET', 'SEQUENCE OF', 'SET OF')
+
+class Tag(object):
+    def __init__(self, cls, number, mode):
+        self.cls = cls          # UNIVERSAL, APPLICATION, ...
+        self.number = number
+        self.mode = mode        # IMPLICIT, EXPLICIT or None (default)
+
+    def cpp(self):
+        return 'asn1::Tag (asn1::%s, %d)' % (self.cls, self.number)
+
+    def key(self):
+        return (self.cls, self.number)
+
+class Type(object):
+    def __init__(self, kind):
+        self.kind = kind        # See UNIVERSAL_NUMBERS, 'STRING', 'CHOICE'
+        self.tags = []          # Outermost first
+        self.components = []    # SEQUENCE, SET, CHOICE
+        self.extensible = False
+        self.element = None     # SEQUENCE OF, SET OF
+        self.items = []         # ENUMERATED: (name, value)
+        self.ref = None         # Type reference
+        self.string = None      # String type name
+        self.lo = None          # INTEGER range
+        self.hi = None
+        self.name = None        # Set for named (hoisted) types
+
+class Component(object):
+    def __init__(self, name, type_):
+        self.name = name
+        self.type = type_
+        self.optional = False
+        self.default = None
+        self.extension = False
+
+# ----------------------------------------------------------------------
+# Parser
+
+class Parser(object):
+    def __init__(self, tokens):
+        self.tokens = tokens
+        self.pos = 0
+        self.values = {}
+
+    def peek(self, n=0):
+        return self.tokens[self.pos + n]
+
+    def next(self):
+        t = self.tokens[self.pos]
+        self.pos += 1
+        return t
+
+    def error(self, msg, tok=None):
+        tok = tok or self.peek()
+        raise CompileError('line %d: %s (at %r)' % (tok.line, msg, tok.text))
+
+    def at(self, *texts):
+        return self.peek().text in texts
+
+    def accept(self, text):
+        if self.peek().text == text:
+            return self.next()
+        return None
+
+    def expect(self, text):
+        t = self.next()
+        if t.text != text:
+            self.pos -= 1
+            self.error('expected %r' % text)
+        return t
+
+    def word(self):
+        t = self.next()
+        if t.kind != 'word':
+            self.pos -= 1
+            self.error('expected a name')
+        return t.text
+
+    def skip_balanced(self, open_, close):
+        depth = 0
+        while True:
+            t = self.next()
+            if t.kind == 'eof':
+                self.error('unbalanced %r' % open_)
+            if t.text == open_:
+                depth += 1
+            elif t.text == close:
+                depth -= 1
+                if not depth:
+                    return
+
+    def module(self):
+        name = self.word()
+        if self.at('{'):
+            self.skip_balanced('{', '}')
+        self.expect('DEFINITIONS')
+        tagging = 'EXPLICIT'
+        if self.at('EXPLICIT', 'IMPLICIT', 'AUTOMATIC'):
+            tagging = self.next().text
+            self.expect('TAGS')
+        if self.accept('EXTENSIBILITY'):
+            self.expect('IMPLIED')
+        self.expect('::=')
+        self.expect('BEGIN')
+        if self.at('EXPORTS'):
+            while not self.accept(';'):
+                self.next()
+        if self.at('IMPORTS'):
+            self.error('IMPORTS are not supported')
+
+        assignments = []
+        while not self.at('END'):
+            if self.peek().kind == 'eof':
+                self.error('missing END')
+            assignments.append(self.assignment())
+        self.expect('END')
+        return name, tagging, assignments
+
+    def assignment(self):
+        name_tok = self.peek()
+        name = self.word()
+        if name[0].isupper():
+            if self.at('{'):
+                self.error('parameterized types are not supported')
+            self.expect('::=')
+            t = self.type()
+            return ('type', name, t)
+
+        # Value assignment
+        t = self.type()
+        self.expect('::=')
+        value = self.value()
+        if t.kind not in ('INTEGER', 'BOOLEAN'):
+            self.error('only INTEGER and BOOLEAN values are supported',
+                       name_tok)
+        self.values[name] = value
+        return ('value', name, (t, value))
+
+    def value(self):
+        t = self.next()
+        if t.kind == 'number':
+            return int(t.text)
+        if t.text in ('TRUE', 'FALSE'):
+            return t.text == 'TRUE'
+        if t.kind == 'word' and t.text[0].islower():
+            return t.text
+        self.pos -= 1
+        self.error('unsupported value')
+
+    def bound(self):
+        t = self.next()
+        if t.text in ('MIN', 'MAX'):
+            return None
+        if t.kind == 'number':
+            return int(t.text)
+        if t.text in self.values and isinstance(self.values[t.text], int):
+            return self.values[t.text]
+        return None
+
+    def constraint(self, t):
+        # Only a simple value range on an INTEGER means anything to us
+        start = self.pos
+        if (t is not None and t.kind == 'INTEGER'
+                and self.peek(1).text != 'SIZE'):
+            self.expect('(')
+            lo = self.bound()
+            if self.accept('..'):
+                hi = self.bound()
+            else:
+                hi = lo
+            if self.accept(')'):
+                t.lo, t.hi = lo, hi
+                return
+            self.pos = start
+        self.skip_balanced('(', ')')
+
+    def tag(self):
+        self.expect('[')
+        cls = 'CONTEXT_SPECIFIC'
+        if self.at('UNIVERSAL', 'APPLICATION', 'PRIVATE'):
+            cls = self.next().text
+        t = self.next()
+        if t.kind == 'number':
+            number = int(t.text)
+        elif t.text in self.values:
+            number = self.values[t.text]
+        else:
+            self.pos -= 1
+            self.error('expected a tag number')
+        self.expect(']')
+        mode = None
+        if self.at('IMPLICIT', 'EXPLICIT'):
+            mode = self.next().text
+        return Tag(cls, number, mode)
+
+    def type(self):
+        tags = []
+        while self.at('['):
+            tags.append(self.tag())
+        t = self.builtin()
+        t.tags = tags + t.tags
+        while self.at('('):
+            self.constraint(t)
+        return t
+
+    def components(self, t, choice=False):
+        self.expect('{')
+        extension = False
+        while not self.accept('}'):
+            if self.accept('...'):
+                t.extensible = True
+                extension = not extension
+            elif self.at('COMPONENTS'):
+                self.error('COMPONENTS OF is not supported')
+            elif self.at('[['):
+                self.error('version brackets are not supported')
+            else:
+                name = self.word()
+                c = Component(name, self.type())
+                c.extension = extension
+                if not choice:
+                    if self.accept('OPTIONAL'):
+                        c.optional = True
+                    elif self.accept('DEFAULT'):
+                        c.default = self.value()
+                t.components.append(c)
+            if not self.accept(','):
+                self.expect('}')
+                break
+
+    def builtin(self):
+        tok = self.next()
+        w = tok.text
+
+        if w in ('BOOLEAN', 'NULL', 'REAL', 'RELATIVE-OID'):
+            return Type(w)
+        if w == 'INTEGER':
+            t = Type('INTEGER')
+            if self.at('{'):
+                self.skip_balanced('{', '}')   # Named numbers
+            return t
+        if w == 'OCTET':
+            self.expect('STRING')
+            return Type('OCTET STRING')
+        if w == 'BIT':
+            self.expect('STRING')
+            if self.at('{'):
+                self.skip_balanced('{', '}')   # Named bits
+            return Type('BIT STRING')
+        if w == 'OBJECT':
+            self.expect('IDENTIFIER')
+            return Type('OBJECT IDENTIFIER')
+        if w in STRING_TYPES:
+            t = Type('STRING')
+            t.string = w
+            return t
+        if w == 'ENUMERATED':
+            t = Type('ENUMERATED')
+            self.expect('{')
+            value = 0
+            used = set()
+            pending = []
+            while not self.accept('}'):
+                if self.accept('...'):
+                    t.extensible = True
+                else:
+                    name = self.word()
+                    if self.accept('('):
+                        v = self.next()
+                        if v.kind != 'number':
+                            self.pos -= 1
+                            self.error('expected a number')
+                        self.expect(')')
+                        t.items.append((name, int(v.text)))
+                        used.add(int(v.text))
+                    else:
+                        t.items.append((name, None))
+                        pending.append(len(t.items) - 1)
+                if not self.accept(','):
+                    self.expect('}')
+                    break
+            # Unnumbered items take the lowest unused values, in order
+            for i in pending:
+                while value in used:
+                    value += 1
+                t.items[i] = (t.items[i][0], value)
+                used.add(value)
+            return t
+        if w in ('SEQUENCE', 'SET'):
+            if self.at('SIZE'):
+                self.next()
+                self.skip_balanced('(', ')')
+            elif self.at('(') and self.peek(1).text == 'SIZE':
+                self.skip_balanced('(', ')')
+            if self.accept('OF'):
+                t = Type(w + ' OF')
+                if self.peek().kind == 'word' and self.peek().text[0].islower():
+                    self.next()                # Element name
+                t.element = self.type()
+                return t
+            t = Type(w)
+            self.components(t)
+            return t
+        if w == 'CHOICE':
+            t = Type('CHOICE')
+            self.components(t, choice=True)
+            return t
+        if tok.kind == 'word' and w[0].isupper():
+            if w in ('ANY', 'EXTERNAL', 'EMBEDDED', 'CHARACTER',
+                     'UTCTime', 'GeneralizedTime', 'TIME', 'DATE',
+                     'TIME-OF-DAY', 'DATE-TIME', 'DURATION'):
+                self.pos -= 1
+                self.error('%s is not supported' % w)
+            t = Type('REF')
+            t.ref = w
+            return t
+
+        self.pos -= 1
+        self.error('expected a type')
+
+# ----------------------------------------------------------------------
+# Semantic analysis
+
+CPP_KEYWORDS = set('''
+    alignas alignof and and_eq asm auto bitand bitor bool break case catch
+    char char16_t char32_t class compl const constexpr const_cast continue
+    decltype default delete do double dynamic_cast else enum explicit
+    export extern false float for friend goto if inline int long mutable
+    namespace new noexcept not not_eq nullptr operator or or_eq private
+    protected public register reinterpret_cast return short signed sizeof
+    static static_assert static_cast struct switch template this
+    thread_local throw true try typedef typeid typename union unsigned
+    using virtual void volatile wchar_t while xor xor_eq
+    d e v t i len indefinite pc
+'''.split())
+
+def cpp_name(name):
+    n = name.replace('-', '_')
+    if n in CPP_KEYWORDS:
+        n += '_'
+    return n
+
+class Module(object):
+    def __init__(self, name, tagging, assignments):
+        self.name = name
+        self.namespace = cpp_name(name)
+        self.tagging = tagging
+        self.types = {}         # Name -> Type, including hoisted ones
+        self.order = []         # Names in declaration order
+        self.values = []
+
+        for kind, name, what in assignments:
+            if kind == 'value':
+                self.values.append((name, what))
+                continue
+            if name in self.types:
+                raise CompileError('%s is defined twice' % name)
+            self.add(name, what)
+
+        for name in list(self.order):
+            self.hoist(self.types[name], name)
+
+        for name in self.order:
+            self.check(self.types[name], name)
+            if self.types[name].kind in ('SEQUENCE', 'SET', 'CHOICE'):
+                self.automatic(self.types[name])
+
+    def add(self, name, t):
+        t.name = name
+        self.types[name] = t
+        self.order.append(name)
+
+    # Give every inline SEQUENCE, SET, CHOICE and ENUMERATED a name of its
+    # own, so we can declare a C++ type for it
+    def hoist(self, t, name):
+        for c in t.components:
+            c.type = self.hoist_one(c.type, '%s-%s' % (name, c.name))
+        if t.element is not None:
+            t.element = self.hoist_one(t.element, '%s-item' % name)
+
+    def hoist_one(self, t, name):
+        if t.kind in ('SEQUENCE', 'SET', 'CHOICE', 'ENUMERATED'):
+            base = name[0].upper() + name[1:]
+            while base in self.types:
+                base += '-'
+            r = Type('REF')
+            r.ref = base
+            r.tags = t.tags
+            t.tags = []
+            self.add(base, t)
+            self.hoist(t, base)
+            return r
+        self.hoist(t, name)
+        return t
+
+    def check(self, t, name):
+        for c in t.components:
+            self.check(c.type, name)
+        if t.element is not None:
+            self.check(t.element, name)
+        if t.kind == 'REF' and t.ref not in self.types:
+            raise CompileError('%s: undefined type %s' % (name, t.ref))
+
+    # X.680 25.3: with AUTOMATIC TAGS, if no component has a tag, number
+    # them all from [0]
+    def automatic(self, t):
+        if self.tagging != 'AUTOMATIC':
+            return
+        if any(c.type.tags for c in t.components):
+            return
+        for n, c in enumerate(t.components):
+            c.type.tags = [Tag('CONTEXT_SPECIFIC', n, None)]
+
+    def resolve(self, t):
+        while t.kind == 'REF':
+            t = self.types[t.ref]
+        return t
+
+    # The tag mode for a tag without IMPLICIT or EXPLICIT, and in any case
+    # tags on an untagged CHOICE are always explicit (X.680 31.2.9)
+    def tag_mode(self, tag, rest_tags, base):
+        mode = tag.mode
+        if mode is None:
+            mode = 'EXPLICIT' if self.tagging == 'EXPLICIT' else 'IMPLICIT'
+        if mode == 'IMPLICIT' and not rest_tags and self.untagged_choice(base):
+            mode = 'EXPLICIT'
+        return mode
+
+    def untagged_choice(self, base):
+        while base.kind == 'REF':
+            base = self.types[base.ref]
+            if base.tags:
+                return False
+        return base.kind == 'CHOICE'
+
+    # Is the outermost encoding of base (with the given tags) constructed?
+    def constructed(self, tags, base):
+        if tags:
+            mode = self.tag_mode(tags[0], tags[1:], base)
+            if mode == 'EXPLICIT':
+                return True
+            return self.constructed(tags[1:], base)
+        if base.kind == 'REF':
+            r = self.types[base.ref]
+            return self.constructed(r.tags, r)
+        return base.kind in CONSTRUCTED_KINDS
+
+    # The set of tags the encoding of a type may start with
+    def first_tags(self, tags, base):
+        if tags:
+            return [tags[0].key()]
+        if base.kind == 'REF':
+            r = self.types[base.ref]
+            return self.first_tags(r.tags, r)
+        if base.kind == 'CHOICE':
+            result = []
+            for c in base.components:
+                result += self.first_tags(c.type.tags, c.type)
+            return result
+        if base.kind == 'STRING':
+            return [('UNIVERSAL', STRING_TYPES[base.string][1])]
+        return [('UNIVERSAL', UNIVERSAL_NUMBERS[base.kind])]
+
+    def cpp_type(self, t):
+        if t.kind == 'REF':
+            r = self.types[t.ref]
+            if r.kind in ('SEQUENCE', 'SET', 'CHOICE', 'ENUMERATED'):
+                return cpp_name(t.ref)
+            return self.cpp_type(r)
+        if t.kind == 'BOOLEAN' or t.kind == 'NULL':
+            return 'bool'
+        if t.kind == 'INTEGER':
+            return integer_type(t.lo, t.hi)
+        if t.kind == 'REAL':
+            return 'double'
+        if t.kind == 'OCTET STRING':
+            return 'std::vector<asn1::octet>'
+        if t.kind == 'BIT STRING':
+            return 'asn1::BitString<>'
+        if t.kind == 'OBJECT IDENTIFIER':
+            return 'asn1::OID'
+        if t.kind == 'RELATIVE-OID':
+            return 'asn1::RelativeOID'
+        if t.kind == 'STRING':
+            return STRING_TYPES[t.string][0]
+        if t.kind in ('SEQUENCE OF', 'SET OF'):
+            return 'std::vector<%s>' % self.cpp_type(t.element)
+        raise CompileError('no C++ type for %s' % t.kind)
+
+def integer_type(lo, hi):
+    if lo is not None and lo >= 0:
+        if hi is not None and hi <= 0xffffffff:
+            return 'asn1::uint32'
+        return 'asn1::uint64'
+    if (lo is not None and hi is not None
+            and lo >= -0x80000000 and hi <= 0x7fffffff):
+        return 'asn1::int32'
+    return 'asn1::int64'
+
+# ----------------------------------------------------------------------
+# Code generation
+
+class Writer(object):
+    def __init__(self):
+        self.lines = []
+        self.indent = 0
+
+    def __call__(self, line=''):
+        if line:
+            self.lines.append('  ' * self.indent + line)
+        else:
+            self.lines.append('')
+
+    def text(self):
+        return '\n'.join(self.lines) + '\n'
+
+class Generator(object):
+    def __init__(self, module):
+        self.m = module
+        self.serial = 0
+
+    def temp(self, prefix):
+        self.serial += 1
+        return '%s%d' % (prefix, self.serial)
+
+    def tag_test(self, var, keys):
+        return ' || '.join('%s == asn1::Tag (asn1::%s, %d)' % (var, c, n)
+                           for c, n in keys)
+
+    def default_value(self, t, value):
+        r = self.m.resolve(t)
+        if isinstance(value, bool):
+            return 'true' if value else 'false'
+        if isinstance(value, int):
+            return str(value)
+        if r.kind == 'ENUMERATED':
+            return '%s_%s' % (cpp_name(r.name), cpp_name(value))
+        for name, (vt, v) in self.m.values:
+            if name == value:
+                return cpp_name(name)
+        raise CompileError('unsupported DEFAULT value %s' % value)
+
+    # Encoding
+
+    def encode(self, w, tags, base, expr):
+        if tags:
+            tag = tags[0]
+            mode = self.m.tag_mode(tag, tags[1:], base)
+            if mode == 'IMPLICIT':
+                form = ('CONSTRUCTED' if self.m.constructed(tags[1:], base)
+                        else 'PRIMITIVE')
+                w('e.overrideNextTag (%s, asn1::%s);' % (tag.cpp(), form))
+                self.encode(w, tags[1:], base, expr)
+            else:
+                w('e.encodeTag (%s, asn1::CONSTRUCTED);' % tag.cpp())
+                w('e.pushState (asn1::DEREncoder::SEQUENCE);')
+                self.encode(w, tags[1:], base, expr)
+                w('e.popState ();')
+            return
+
+        if base.kind == 'REF':
+            r = self.m.types[base.ref]
+            if r.kind in ('SEQUENCE', 'SET', 'CHOICE', 'ENUMERATED'):
+                w('e << %s;' % expr)
+            else:
+                self.encode(w, r.tags, r, expr)
+        elif base.kind == 'NULL':
+            w('e << asn1::null;')
+        elif base.kind in ('SEQUENCE OF', 'SET OF'):
+            if base.kind == 'SET OF':
+                w('e.encodeTag (asn1::tSet, asn1::CONSTRUCTED);')
+                w('e.pushState (asn1::DEREncoder::SET);')
+            else:
+                w('e.encodeTag (asn1::tSequence, asn1::CONSTRUCTED);')
+                w('e.pushState (asn1::DEREncoder::SEQUENCE);')
+            i = self.temp('i')
+            if expr.startswith('*'):
+                expr = '(%s)' % expr
+            w('for (auto %s = %s.begin(); %s != %s.end(); ++%s) {'
+              % (i, expr, i, expr, i))
+            w.indent += 1
+            self.encode(w, base.element.tags, base.element, '*' + i)
+            w.indent -= 1
+            w('}')
+            w('e.popState ();')
+        else:
+            w('e << %s;' % expr)
+
+    def encode_components(self, w, t):
+        for c in t.components:
+            member = 'v.' + cpp_name(c.name)
+            if c.optional:
+                w('if (%s.present()) {' % member)
+                w.indent += 1
+                self.encode(w, c.type.tags, c.type, '*' + member)
+                w.indent -= 1
+                w('}')
+            elif c.default is not None:
+                w('if (!(%s == %s)) {'
+                  % (member, self.default_value(c.type, c.default)))
+                w.indent += 1
+                self.encode(w, c.type.tags, c.type, member)
+                w.indent -= 1
+                w('}')
+            else:
+                self.encode(w, c.type.tags, c.type, member)
+
+    # Decoding
+
+    def decode(self, w, tags, base, expr):
+        if tags:
+            tag = tags[0]
+            mode = self.m.tag_mode(tag, tags[1:], base)
+            if mode == 'IMPLICIT':
+                form = ('CONSTRUCTED' if self.m.constructed(tags[1:], base)
+                        else 'PRIMITIVE')
+                w('d.overrideNextTag (%s, asn1::%s);' % (tag.cpp(), form))
+                self.decode(w, tags[1:], base, expr)
+            else:
+                self.decode_push(w, tag.cpp())
+                self.decode(w, tags[1:], base, expr)
+                w.indent -= 1
+                w('  asn1::end (d);')
+                w('}')
+            return
+
+        if base.kind == 'REF':
+            r = self.m.types[base.ref]
+            if r.kind in ('SEQUENCE', 'SET', 'CHOICE', 'ENUMERATED'):
+                w('d >> %s;' % expr)
+            else:
+                self.decode(w, r.tags, r, expr)
+        elif base.kind == 'NULL':
+            w('d >> asn1::null;')
+        elif base.kind in ('SEQUENCE OF', 'SET OF'):
+            el = base.element
+            rel = self.m.resolve(el)
+            # Untagged SEQUENCE OF INTEGER/BOOLEAN use the bulk decoder
+            if (base.kind == 'SEQUENCE OF' and not el.tags
+                    and (el.kind != 'REF' or not self.m.types[el.ref].tags)
+                    and rel.kind in ('INTEGER', 'BOOLEAN')):
+                w('%s.clear();' % expr)
+                w('d >> %s;' % expr)
+                return
+            self.decode_push(w, 'asn1::%s' % ('tSet' if base.kind == 'SET OF'
+                                               else 'tSequence'))
+            w('%s.clear();' % expr)
+            w('while (!d.atEnd()) {')
+            w.indent += 1
+            if self.m.cpp_type(el) == 'bool':
+                b = self.temp('b')
+                w('bool %s = false;' % b)
+                self.decode(w, el.tags, el, b)
+                w('%s.push_back (%s);' % (expr, b))
+            else:
+                w('%s.emplace_back ();' % expr)
+                self.decode(w, el.tags, el, expr + '.back()')
+            w.indent -= 1
+            w('}')
+            w.indent -= 1
+            w('  asn1::end (d);')
+            w('}')
+        else:
+            w('d >> %s;' % expr)
+
+    def decode_push(self, w, tag):
+        w('{')
+        w.indent += 1
+        w('bool indefinite;')
+        w('size_t len = d.expectHeader (%s, asn1::CONSTRUCTED, indefinite);'
+          % tag)
+        w('d.pushState (indefinite, len);')
+
+    def decode_sequence_components(self, w, t):
+        for c in t.components:
+            member = 'v.' + cpp_name(c.name)
+            if c.optional or c.default is not None or c.extension:
+                keys = self.m.first_tags(c.type.tags, c.type)
+                w('t = d.atEnd() ? asn1::Tag () : d.peekTag (pc);')
+                w('if (!d.failed() && (%s)) {' % self.tag_test('t', keys))
+                w.indent += 1
+                if c.optional:
+                    w('%s.emplace();' % member)
+                    self.decode(w, c.type.tags, c.type, '(*%s)' % member)
+                else:
+                    self.decode(w, c.type.tags, c.type, member)
+                w.indent -= 1
+                w('} else {')
+                if c.optional:
+                    w('  %s.reset();' % member)
+                elif c.default is not None:
+                    w('  %s = %s;'
+                      % (member, self.default_value(c.type, c.default)))
+                w('}')
+            else:
+                self.decode(w, c.type.tags, c.type, member)
+
+    # Types
+
+    def declare(self, h, name, t):
+        cname = cpp_name(name)
+        if t.kind == 'ENUMERATED':
+            h('enum %s {' % cname)
+            for i, (item, value) in enumerate(t.items):
+                h('  %s_%s = %d%s' % (cname, cpp_name(item), value,
+                                      ',' if i + 1 < len(t.items) else ''))
+            h('};')
+        elif t.kind in ('SEQUENCE', 'SET'):
+            h('struct %s {' % cname)
+            for c in t.components:
+                ct = self.m.cpp_type(c.type)
+                if c.optional:
+                    ct = 'asn1::schema::opt<%s>' % ct
+                h('  %s %s;' % (ct, cpp_name(c.name)))
+            inits = []
+            for c in t.components:
+                if c.default is not None:
+                    inits.append('%s(%s)' % (cpp_name(c.name),
+                                             self.default_value(c.type,
+                                                                c.default)))
+                elif (not c.optional
+                      and self.m.cpp_type(c.type) in SCALARS):
+                    inits.append('%s()' % cpp_name(c.name))
+            if inits:
+                h('')
+                h('  %s() : %s {}' % (cname, ', '.join(inits)))
+            h('};')
+        elif t.kind == 'CHOICE':
+            h('struct %s {' % cname)
+            h('  enum Alternative {')
+            h('    NONE = 0,')
+            for i, c in enumerate(t.components):
+                h('    %s%s' % (cpp_name(c.name).upper(),
+                               ',' if i + 1 < len(t.components) else ''))
+            h('  };')
+            h('')
+            h('  Alternative which;')
+            for c in t.components:
+                h('  %s %s;' % (self.m.cpp_type(c.type), cpp_name(c.name)))
+            h('')
+            h('  %s() : which(NONE) {}' % cname)
+            h('};')
+        else:
+            h('typedef %s %s;' % (self.m.cpp_type(t), cname))
+
+    def define(self, c, name, t):
+        cname = cpp_name(name)
+
+        c('asn1::DEREncoder &')
+        c('operator<< (asn1::DEREncoder &e, %sv)'
+          % (cname + ' ' if t.kind == 'ENUMERATED' else 'const %s &' % cname))
+        c('{')
+        c.indent += 1
+        if t.kind == 'ENUMERATED':
+            base = Type('INTEGER')
+            tags = t.tags + [Tag('UNIVERSAL', 10, 'IMPLICIT')]
+            self.encode(c, tags, base, 'asn1::int64 (v)')
+        elif t.kind == 'CHOICE':
+            def alternatives(w, expr):
+                w('switch (v.which) {')
+                for comp in t.components:
+                    w('case %s::%s:' % (cname, cpp_name(comp.name).upper()))
+                    w.indent += 1
+                    self.encode(w, comp.type.tags, comp.type,
+                                'v.' + cpp_name(comp.name))
+                    w('break;')
+                    w.indent -= 1
+                w('default:')
+                w('  throw std::runtime_error ("uninitialized choice");')
+                w('}')
+            self.encode_wrapped(c, t, alternatives)
+        else:
+            kind = 'SET' if t.kind == 'SET' else 'SEQUENCE'
+            def body(w, expr):
+                w('e.encodeTag (asn1::t%s, asn1::CONSTRUCTED);'
+                  % kind.capitalize())
+                w('e.pushState (asn1::DEREncoder::%s);' % kind)
+                self.encode_components(w, t)
+                w('e.popState ();')
+            self.encode_wrapped(c, t, body)
+        c('return e;')
+        c.indent -= 1
+        c('}')
+        c('')
+
+        c('asn1::BERDecoder &')
+        c('operator>> (asn1::BERDecoder &d, %s &v)' % cname)
+        c('{')
+        c.indent += 1
+        if t.kind == 'ENUMERATED':
+            c('asn1::int64 i = 0;')
+            base = Type('INTEGER')
+            tags = t.tags + [Tag('UNIVERSAL', 10, 'IMPLICIT')]
+            self.decode(c, tags, base, 'i')
+            c('v = static_cast<%s>(i);' % cname)
+        elif t.kind == 'CHOICE':
+            c('asn1::PrimitiveOrConstructed pc;')
+            self.decode_wrapped(c, t, lambda w: self.decode_choice(w, t))
+        elif t.kind == 'SET':
+            c('asn1::PrimitiveOrConstructed pc;')
+            self.decode_wrapped(c, t, lambda w: self.decode_set(w, t))
+        else:
+            c('asn1::PrimitiveOrConstructed pc;')
+            c('asn1::Tag t;')
+            c('(void)pc;')
+            c('(void)t;')
+            def body(w):
+                self.decode_push(w, 'asn1::tSequence')
+                self.decode_sequence_components(w, t)
+                if t.extensible:
+                    w('while (!d.atEnd())')
+                    w('  d.skip();')
+                w.indent -= 1
+                w('  asn1::end (d);')
+                w('}')
+            self.decode_wrapped(c, t, body)
+        c('return d;')
+        c.indent -= 1
+        c('}')
+        c('')
+
+    # A named type's own tags wrap its body
+    def encode_wrapped(self, w, t, body):
+        tags = t.tags
+        if not tags:
+            body(w, 'v')
+            return
+        tag = tags[0]
+        mode = self.m.tag_mode(tag, tags[1:], t)
+        rest = Type(t.kind)
+        rest.components = t.components
+        rest.tags = tags[1:]
+        if mode == 'IMPLICIT':
+            form = ('CONSTRUCTED' if self.m.constructed(tags[1:], t)
+                    else 'PRIMITIVE')
+            w('e.overrideNextTag (%s, asn1::%s);' % (tag.cpp(), form))
+        else:
+            w('e.encodeTag (%s, asn1::CONSTRUCTED);' % tag.cpp())
+            w('e.pushState (asn1::DEREncoder::SEQUENCE);')
+        saved = t.tags
+        t.tags = tags[1:]
+        self.encode_wrapped(w, t, body)
+        t.tags = saved
+        if mode == 'EXPLICIT':
+            w('e.popState ();')
+
+    def decode_wrapped(self, w, t, body):
+        tags = t.tags
+        if not tags:
+            body(w)
+            return
+        tag = tags[0]
+        mode = self.m.tag_mode(tag, tags[1:], t)
+        if mode == 'IMPLICIT':
+            form = ('CONSTRUCTED' if self.m.constructed(tags[1:], t)
+                    else 'PRIMITIVE')
+            w('d.overrideNextTag (%s, asn1::%s);' % (tag.cpp(), form))
+        else:
+            self.decode_push(w, tag.cpp())
+        saved = t.tags
+        t.tags = tags[1:]
+        self.decode_wrapped(w, t, body)
+        t.tags = saved
+        if mode == 'EXPLICIT':
+            w.indent -= 1
+            w('  asn1::end (d);')
+            w('}')
+
+    def decode_choice(self, w, t):
+        cname = cpp_name(t.name)
+        w('asn1::Tag t = d.peekTag (pc);')
+        w('if (d.failed())')
+        w('  return d;')
+        w('switch (tag_key (t)) {')
+        seen = {}
+        for comp in t.components:
+            keys = self.m.first_tags(comp.type.tags, comp.type)
+            for k in keys:
+                if k in seen:
+                    raise CompileError('%s: alternatives %s and %s have the '
+                                       'same tag' % (t.name, seen[k],
+                                                     comp.name))
+                seen[k] = comp.name
+                w('case tag_key (asn1::Tag (asn1::%s, %d)):' % k)
+            w.indent += 1
+            w('v.which = %s::%s;' % (cname, cpp_name(comp.name).upper()))
+            self.decode(w, comp.type.tags, comp.type,
+                        'v.' + cpp_name(comp.name))
+            w('break;')
+            w.indent -= 1
+        w('default:')
+        if t.extensible:
+            w('  // An unknown extension')
+            w('  v.which = %s::NONE;' % cname)
+            w('  d.skip();')
+        else:
+            w('  d.fail (asn1::BERDecoder::UNEXPECTED_TAG,')
+            w('          "no alternative of choice has tag");')
+        w('}')
+
+    def decode_set(self, w, t):
+        self.decode_push(w, 'asn1::tSet')
+        for i, comp in enumerate(t.components):
+            w('bool seen%d = false;' % i)
+        w('while (!d.atEnd()) {')
+        w.indent += 1
+        w('asn1::Tag t = d.peekTag (pc);')
+        w('if (d.failed())')
+        w('  break;')
+        w('switch (tag_key (t)) {')
+        for i, comp in enumerate(t.components):
+            member = 'v.' + cpp_name(comp.name)
+            for k in self.m.first_tags(comp.type.tags, comp.type):
+                w('case tag_key (asn1::Tag (asn1::%s, %d)):' % k)
+            w.indent += 1
+            # Leave the loop through the usual exit, which pops the state
+            w('if (seen%d) {' % i)
+            w('  d.fail (asn1::BERDecoder::BAD_VALUE,')
+            w('          "duplicate component in set");')
+            w('  break;')
+            w('}')
+            w('seen%d = true;' % i)
+            if comp.optional:
+                w('%s.emplace();' % member)
+                member = '(*%s)' % member
+            self.decode(w, comp.type.tags, comp.type, member)
+            w('break;')
+            w.indent -= 1
+        w('default:')
+        if t.extensible:
+            w('  d.skip();')
+        else:
+            w('  d.fail (asn1::BERDecoder::UNEXPECTED_TAG,')
+            w('          "unexpected component in set");')
+        w('}')
+        w.indent -= 1
+        w('}')
+        for i, comp in enumerate(t.components):
+            member = 'v.' + cpp_name(comp.name)
+            if comp.optional:
+                w('if (!seen%d)' % i)
+                w('  %s.reset();' % member)
+            elif comp.default is not None:
+                w('if (!seen%d)' % i)
+                w('  %s = %s;' % (member,
+                                  self.default_value(comp.type, comp.default)))
+            elif not comp.extension:
+                w('if (!seen%d && !d.failed())' % i)
+                w('  d.fail (asn1::BERDecoder::BAD_VALUE,')
+                w('          "missing component %s in set");' % comp.name)
+        w.indent -= 1
+        w('  asn1::end (d);')
+        w('}')
+
+    # Order the declarations so that every type a struct holds by value
+    # is declared before it
+    def declaration_order(self):
+        done = set()
+        result = []
+        visiting = set()
+
+        def deps(t):
+            out = []
+            for c in t.components:
+                out += refs(c.type)
+            if t.element is not None:
+                out += refs(t.element)
+            return out
+
+        def refs(t):
+            if t.kind == 'REF':
+                return [t.ref]
+            if t.element is not None:
+                return refs(t.element)
+            return []
+
+        def visit(name):
+            if name in done:
+                return
+            if name in visiting:
+                raise CompileError('%s is recursive, which is not supported'
+                                   % name)
+            visiting.add(name)
+            for d in deps(self.m.types[name]):
+                visit(d)
+            visiting.discard(name)
+            done.add(name)
+            result.append(name)
+
+        for name in self.m.order:
+            visit(name)
+        return result
+
+    def generate(self, stem):
+        m = self.m
+        guard = 'ASN1_GEN_%s_H_' % re.sub(r'\W', '_', stem).upper()
+        order = self.declaration_order()
+        named = [n for n in order
+                 if m.types[n].kind in ('SEQUENCE', 'SET', 'CHOICE',
+                                        'ENUMERATED')]
+
+        h = Writer()
+        h('/* Emacs, this is -*-C++-*- */')
+        h('')
+        h('/* Generated by tools/asn1c.py from %s.asn1; do not edit. */' % stem)
+        h('')
+        h('#ifndef %s' % guard)
+        h('#define %s' % guard)
+        h('')
+        h('#include <asn1/BERDecoder.h>')
+        h('#include <asn1/DEREncoder.h>')
+        h('#include <asn1/schema.h>')
+        h('')
+        h('#include <vector>')
+        h('')
+        h('namespace %s {' % m.namespace)
+        h('')
+        for name, (t, value) in m.values:
+            h('const %s %s = %s;'
+              % ('bool' if t.kind == 'BOOLEAN' else m.cpp_type(t),
+                 cpp_name(name),
+                 ('true' if value else 'false') if t.kind == 'BOOLEAN'
+                 else str(value)))
+        if m.values:
+            h('')
+        for name in order:
+            self.declare(h, name, m.types[name])
+            h('')
+        for name in named:
+            t = m.types[name]
+            cname = cpp_name(name)
+            h('asn1::DEREncoder &operator<< (asn1::DEREncoder &e, %sv);'
+              % (cname + ' ' if t.kind == 'ENUMERATED' else 'const %s &' % cname))
+            h('asn1::BERDecoder &operator>> (asn1::BERDecoder &d, %s &v);'
+              % cname)
+        h('')
+        h('} // namespace %s' % m.namespace)
+        h('')
+        h('#endif /* %s */' % guard)
+
+        c = Writer()
+        c('/* Generated by tools/asn1c.py from %s.asn1; do not edit. */' % stem)
+        c('')
+        c('#include "%s.h"' % stem)
+        c('')
+        c('#include <stdexcept>')
+        c('')
+        c('namespace %s {' % m.namespace)
+        c('')
+        c('// One integer per tag, so that we can switch on tags')
+        c('static constexpr asn1::uint64 tag_key (asn1::Tag t)')
+        c('{')
+        c('  return (asn1::uint64 (t.tagClass) << 32) | t.number;')
+        c('}')
+        c('')
+        for name in named:
+            self.define(c, name, m.types[name])
+        c('} // namespace %s' % m.namespace)
+
+        return h.text(), c.text()
+
+SCALARS = ('bool', 'double', 'asn1::int32', 'asn1::uint32', 'asn1::int64',
+           'asn1::uint64')
+
+def main():
+    ap = argparse.ArgumentParser(description='Compile an ASN.1 module '
+                                 'to C++ codecs for libasn1')
+    ap.add_argument('-o', '--output', default='.',
+                    help='directory for the generated files')
+    ap.add_argument('module', help='ASN.1 module')
+    args = ap.parse_args()
+
+    stem = os.path.splitext(os.path.basename(args.module))[0]
+
+    try:
+        with open(args.module) as f:
+            parser = Parser(tokenize(f.read()))
+        name, tagging, assignments = parser.module()
+        module = Module(name, tagging, assignments)
+        header, source = Generator(module).generate(stem)
+    except CompileError as e:
+        sys.stderr.write('%s: %s\n' % (args.module, e))
+        return 1
+
+    if not os.path.isdir(args.output):
+        os.makedirs(args.output)
+    with open(os.path.join(args.output, stem + '.h'), 'w') as f:
+        f.write(header)
+    with open(os.path.join(args.output, stem + '.cc'), 'w') as f:
+        f.write(source)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,26 @@
+#include <io.h>
+#include <errno.h>
+
+#include <asn1/sink.h>
+
+#include <climits>
+#include <stdexcept>
+#include <string>
+
+using namespace asn1;
+
+void
+fd_sink::write (const octet *data, size_t len)
+{
+  while (len) {
+    unsigned chunk = len > INT_MAX ? INT_MAX : (unsigned)len;
+    int done = ::_write (_fd, data, chunk);
+
+    if (done < 0)
+      throw std::runtime_error(std::string("fd_sink: _write: errno ")
+                               + std::to_string(errno));
+
+    data += done;
+    len -= done;
+  }
+}
@@ -0,0 +1,91 @@
+#include <windows.h>
+
+#include <asn1/mapped_file.h>
+#include <asn1/strings.h>
+
+#include <stdexcept>
+
+using namespace asn1;
+
+// err is GetLastError() from the call that failed, taken before cleanup
+static void
+throw_win32 (const char *what, DWORD err)
+{
+  throw std::runtime_error(std::string("mapped_file: ") + what
+                           + ": win32 error " + std::to_string(err));
+}
+
+void
+mapped_file::map (const std::string &path, AccessPattern pattern)
+{
+  std::u16string wpath = utf8_to_utf16 (path);
+  HANDLE hFile = CreateFileW ((LPCWSTR)wpath.c_str(),
+                              GENERIC_READ,
+                              FILE_SHARE_READ,
+                              NULL,
+                              OPEN_EXISTING,
+                              pattern == SEQUENTIAL
+                              ? FILE_FLAG_SEQUENTIAL_SCAN
+                              : FILE_FLAG_RANDOM_ACCESS,
+                              NULL);
+
+  if (hFile == INVALID_HANDLE_VALUE)
+    throw_win32 ("CreateFile", GetLastError());
+
+  LARGE_INTEGER size;
+
+  if (!GetFileSizeEx (hFile, &size)) {
+    DWORD err = GetLastError();
+    CloseHandle (hFile);
+    throw_win32 ("GetFileSizeEx", err);
+  }
+
+  if (static_cast<unsigned long long>(size.QuadPart)
+      > static_cast<size_t>(-1)) {
+    CloseHandle (hFile);
+    throw std::runtime_error("mapped_file: file too large to map");
+  }
+
+  _size = static_cast<size_t>(size.QuadPart);
+
+  // CreateFileMapping() won't map an empty file either
+  if (!_size) {
+    CloseHandle (hFile);
+    return;
+  }
+
+  HANDLE hMapping = CreateFileMappingW (hFile, NULL, PAGE_READONLY,
+                                        0, 0, NULL);
+  DWORD err = GetLastError();
+
+  CloseHandle (hFile);
+
+  if (!hMapping) {
+    _size = 0;
+    throw_win32 ("CreateFileMapping", err);
+  }
+
+  void *ptr = MapViewOfFile (hMapping, FILE_MAP_READ, 0, 0, 0);
+
+  if (!ptr) {
+    err = GetLastError();
+    CloseHandle (hMapping);
+    _size = 0;
+    throw_win32 ("MapViewOfFile", err);
+  }
+
+  _data = (const octet *)ptr;
+  _handle = hMapping;
+}
+
+void
+mapped_file::unmap ()
+{
+  if (_data)
+    UnmapViewOfFile (_data);
+  if (_handle)
+    CloseHandle ((HANDLE)_handle);
+  _data = nullptr;
+  _size = 0;
+  _handle = nullptr;
+}